@@ -0,0 +1,982 @@
+/*---------------------------------------------------------------------------*/
+/**
+ * \file
+ * Load generator for the broker of the MQTT motes.
+ *
+ * Simulates thousands of mqtt-mote instances on the host, each with its own
+ * connection to the broker, all served by one epoll loop. Every virtual mote
+ * follows the protocol of mqtt-mote.c:
+ *  - CONNECT with the client id and credentials of a native mote
+ *  - SUBSCRIBE to mtds/sensor/conf/<id>, then PUBLISH <id> on mtds/sensor/conf
+ *  - wait for its location N/B/F/R on mtds/sensor/conf/<id>, UNSUBSCRIBE
+ *  - PUBLISH a reading on mtds/sensor/data/N/B/F/R every interval, in the
+ *    JSON format of the mote (or the binary one with -B)
+ * The registration is sent as soon as the subscription is acknowledged (the
+ * mote waits one period) and the first readings are spread over the first
+ * interval, so that the motes do not publish in lockstep.
+ *
+ * A monitor connection subscribed to mtds/sensor/data/# receives the readings
+ * back: the report has the publish rate, the share of readings delivered and
+ * the percentiles of the end-to-end latency and of the registration time.
+ * With -c the tool also answers the registrations, in place of Node-RED or
+ * sensor_configurator.py.
+ */
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+/*---------------------------------------------------------------------------*/
+/* As in project-conf.h and mqtt-mote.c */
+#define PUBLISH_LOCATION     "mtds/sensor/data/"
+#define PUBLISH_CONF_TOPIC   "mtds/sensor/conf"
+#define SUB_CONF_TOPIC       "mtds/sensor/conf/"
+#define DEFAULT_ORG_ID       "mtdssens"
+#define DEFAULT_TYPE_ID      "native"
+#define DEFAULT_AUTH_TOKEN   "AUTHZ"
+#define DEF_ROUTE            "fe80::1"
+#define RECONNECT_INTERVAL   2.0
+#define PAYLOAD_BINARY_VERSION 2
+/*---------------------------------------------------------------------------*/
+/* MQTT 3.1.1 packets (first byte, QoS 0 only) */
+#define MQTT_CONNECT       0x10
+#define MQTT_CONNACK       0x20
+#define MQTT_PUBLISH       0x30
+#define MQTT_SUBSCRIBE     0x82
+#define MQTT_SUBACK        0x90
+#define MQTT_UNSUBSCRIBE   0xA2
+#define MQTT_UNSUBACK      0xB0
+#define MQTT_PINGREQ       0xC0
+#define MQTT_PINGRESP      0xD0
+/*---------------------------------------------------------------------------*/
+/* Various states */
+#define STATE_IDLE         0 /* Not connected, waiting for the timer */
+#define STATE_CONNECTING   1 /* TCP connection in progress */
+#define STATE_CONNACK      2 /* CONNECT sent */
+#define STATE_SUBACK       3 /* SUBSCRIBE sent */
+#define STATE_LISTENING    4 /* Registration sent, waiting for the location */
+#define STATE_PUBLISHING   5
+#define STATE_READY        6 /* Monitor or configurator subscribed */
+
+#define ROLE_MOTE          0
+#define ROLE_MONITOR       1
+#define ROLE_CONFIGURATOR  2
+/*---------------------------------------------------------------------------*/
+/* Send times of the last readings of a mote, by seq */
+#define SENT_SLOTS         16
+
+typedef struct buffer {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} buffer_t;
+
+typedef struct client {
+    int fd;
+    uint8_t role;
+    uint8_t state;
+    uint8_t want_out;
+    const char *broken;
+    uint16_t node_id;
+    uint16_t seq;
+    uint16_t packet_id;
+    uint32_t random;
+    uint32_t timer_gen;
+    double started;
+    double next_publish;
+    buffer_t in;
+    buffer_t out;
+    char pub_topic[64];
+    uint16_t sent_seq[SENT_SLOTS];
+    double sent_time[SENT_SLOTS];
+} client_t;
+
+typedef struct timer_entry {
+    double time;
+    uint32_t client;
+    uint32_t gen;
+} timer_entry_t;
+
+typedef struct samples {
+    uint32_t *values;
+    size_t len;
+    size_t cap;
+} samples_t;
+/*---------------------------------------------------------------------------*/
+static struct {
+    const char *broker;
+    const char *port;
+    unsigned int motes;
+    double interval;
+    double duration;
+    double ramp;
+    int configure;
+    int binary;
+} opt = { "localhost", "1883", 1000, 60, 120, 1000, 0, 0 };
+
+static struct sockaddr_storage broker_addr;
+static socklen_t broker_addr_len;
+static int epoll_fd;
+static client_t *clients;
+static unsigned int client_count;
+static timer_entry_t *timers;
+static size_t timer_count;
+static size_t timer_cap;
+static double end_time;
+static volatile sig_atomic_t interrupted;
+
+static unsigned int connected;
+static unsigned int registered;
+static unsigned long published;
+static unsigned long received;
+static unsigned long errors;
+static samples_t latencies;   /* microseconds */
+static samples_t handshakes;  /* microseconds */
+/*---------------------------------------------------------------------------*/
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/*---------------------------------------------------------------------------*/
+static void *
+xrealloc(void *p, size_t size)
+{
+    p = realloc(p, size);
+    if(p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+/*---------------------------------------------------------------------------*/
+static void
+samples_add(samples_t *s, double seconds)
+{
+    if(s->len == s->cap) {
+        s->cap = s->cap ? 2 * s->cap : 4096;
+        s->values = xrealloc(s->values, s->cap * sizeof(uint32_t));
+    }
+    s->values[s->len++] = seconds <= 0 ? 0 : seconds >= 4294 ? UINT32_MAX : (uint32_t)(seconds * 1e6);
+}
+/*---------------------------------------------------------------------------*/
+static int
+compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+/*---------------------------------------------------------------------------*/
+static double
+percentile_ms(const samples_t *s, double p)
+{
+    return s->values[(size_t)(p * (s->len - 1))] / 1e3;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_percentiles(const char *name, samples_t *s)
+{
+    if(s->len == 0) {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    qsort(s->values, s->len, sizeof(uint32_t), compare_u32);
+    printf("%s (ms): p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f max %.3f\n", name,
+           percentile_ms(s, 0.5), percentile_ms(s, 0.9), percentile_ms(s, 0.99),
+           percentile_ms(s, 0.999), percentile_ms(s, 1));
+}
+/*---------------------------------------------------------------------------*/
+/* Timers: a binary heap of (time, client); an entry is stale once the client
+ * has set a newer timer */
+static void
+set_timer(client_t *c, double time)
+{
+    size_t i;
+    timer_entry_t entry;
+
+    if(timer_count == timer_cap) {
+        timer_cap = timer_cap ? 2 * timer_cap : 1024;
+        timers = xrealloc(timers, timer_cap * sizeof(timer_entry_t));
+    }
+    entry.time = time;
+    entry.client = c - clients;
+    entry.gen = ++c->timer_gen;
+    for(i = timer_count++; i > 0 && timers[(i - 1) / 2].time > time; i = (i - 1) / 2) {
+        timers[i] = timers[(i - 1) / 2];
+    }
+    timers[i] = entry;
+}
+/*---------------------------------------------------------------------------*/
+static timer_entry_t
+pop_timer(void)
+{
+    timer_entry_t top = timers[0];
+    timer_entry_t last = timers[--timer_count];
+    size_t i = 0;
+    size_t child;
+
+    while((child = 2 * i + 1) < timer_count) {
+        if(child + 1 < timer_count && timers[child + 1].time < timers[child].time) {
+            child++;
+        }
+        if(timers[child].time >= last.time) {
+            break;
+        }
+        timers[i] = timers[child];
+        i = child;
+    }
+    timers[i] = last;
+    return top;
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t
+next_random(client_t *c)
+{
+    /* xorshift32 */
+    c->random ^= c->random << 13;
+    c->random ^= c->random >> 17;
+    c->random ^= c->random << 5;
+    return c->random;
+}
+/*---------------------------------------------------------------------------*/
+static void
+buffer_append(buffer_t *b, const void *data, size_t len)
+{
+    if(b->len + len > b->cap) {
+        while(b->len + len > b->cap) {
+            b->cap = b->cap ? 2 * b->cap : 256;
+        }
+        b->data = xrealloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+/*---------------------------------------------------------------------------*/
+static void
+buffer_consume(buffer_t *b, size_t len)
+{
+    memmove(b->data, b->data + len, b->len - len);
+    b->len -= len;
+}
+/*---------------------------------------------------------------------------*/
+static void
+watch(client_t *c, int want_out)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+    ev.data.u32 = c - clients;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = want_out;
+}
+/*---------------------------------------------------------------------------*/
+/* A failed send only marks the connection: it is closed by the event loop,
+ * once the handler that was sending has returned */
+static void
+flush_out(client_t *c)
+{
+    ssize_t n;
+
+    while(c->out.len > 0 && c->broken == NULL) {
+        n = send(c->fd, c->out.data, c->out.len, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            c->broken = strerror(errno);
+            return;
+        }
+        buffer_consume(&c->out, n);
+    }
+    if((c->out.len > 0) != c->want_out) {
+        watch(c, c->out.len > 0);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* Packet under construction: fixed header written once the length is known */
+static uint8_t body[1024];
+static size_t body_len;
+
+static void
+put_u8(uint8_t value)
+{
+    body[body_len++] = value;
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_u16(uint16_t value)
+{
+    body[body_len++] = value >> 8;
+    body[body_len++] = value & 0xFF;
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_bytes(const void *data, size_t len)
+{
+    memcpy(body + body_len, data, len);
+    body_len += len;
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_string(const char *s)
+{
+    put_u16(strlen(s));
+    put_bytes(s, strlen(s));
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_packet(client_t *c, uint8_t type)
+{
+    uint8_t header[5];
+    size_t header_len = 0;
+    size_t remaining = body_len;
+
+    header[header_len++] = type;
+    do {
+        header[header_len] = remaining & 0x7F;
+        remaining >>= 7;
+        if(remaining > 0) {
+            header[header_len] |= 0x80;
+        }
+        header_len++;
+    } while(remaining > 0);
+
+    buffer_append(&c->out, header, header_len);
+    buffer_append(&c->out, body, body_len);
+    body_len = 0;
+    flush_out(c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_subscribe(client_t *c, const char *topic)
+{
+    put_u16(++c->packet_id);
+    put_string(topic);
+    put_u8(0);
+    send_packet(c, MQTT_SUBSCRIBE);
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_publish(client_t *c, const char *topic, const void *payload, size_t len)
+{
+    put_string(topic);
+    put_bytes(payload, len);
+    send_packet(c, MQTT_PUBLISH);
+}
+/*---------------------------------------------------------------------------*/
+static void
+client_py_id(const client_t *c, char *out, size_t size)
+{
+    snprintf(out, size, "%s-%02x%02x", DEFAULT_ORG_ID, c->node_id >> 8, c->node_id & 0xFF);
+}
+/*---------------------------------------------------------------------------*/
+/* Three intervals, as the mote, between 60 s and the MQTT maximum */
+static uint16_t
+keep_alive(void)
+{
+    return opt.interval * 3 < 60 ? 60 : opt.interval * 3 > 0xFFFF ? 0xFFFF : opt.interval * 3;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_connect(client_t *c)
+{
+    char client_id[64];
+
+    if(c->role == ROLE_MOTE) {
+        /* The link address of mote n is 00:00:00:00:00:00:hi(n):lo(n) */
+        snprintf(client_id, sizeof(client_id), "d:%s:%s:00000000%02x%02x",
+                 DEFAULT_ORG_ID, DEFAULT_TYPE_ID, c->node_id >> 8, c->node_id & 0xFF);
+    } else {
+        snprintf(client_id, sizeof(client_id), "mtds-loadgen-%s-%d",
+                 c->role == ROLE_MONITOR ? "monitor" : "configurator", (int)getpid());
+    }
+
+    put_string("MQTT");
+    put_u8(4);
+    /* Clean session, user name and password as in mqtt_set_username_password() */
+    put_u8(0xC2);
+    put_u16(keep_alive());
+    put_string(client_id);
+    put_string("use-token-auth");
+    put_string(DEFAULT_AUTH_TOKEN);
+    send_packet(c, MQTT_CONNECT);
+    c->state = STATE_CONNACK;
+}
+/*---------------------------------------------------------------------------*/
+static void client_failed(client_t *c, const char *why);
+/*---------------------------------------------------------------------------*/
+static void
+open_connection(client_t *c)
+{
+    struct epoll_event ev;
+    int one = 1;
+
+    c->fd = socket(broker_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c->fd < 0) {
+        client_failed(c, strerror(errno));
+        return;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->in.len = 0;
+    c->out.len = 0;
+    c->broken = NULL;
+    c->started = now_seconds();
+    c->state = STATE_CONNECTING;
+
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = c - clients;
+    c->want_out = 1;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0 ||
+       (connect(c->fd, (struct sockaddr *)&broker_addr, broker_addr_len) < 0 && errno != EINPROGRESS)) {
+        client_failed(c, strerror(errno));
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+client_failed(client_t *c, const char *why)
+{
+    if(c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+        if(c->state > STATE_CONNACK) {
+            connected--;
+        }
+    }
+    if(c->state == STATE_PUBLISHING) {
+        registered--;
+    }
+    errors++;
+    if(errors <= 10) {
+        fprintf(stderr, "Connection %u: %s\n", (unsigned int)(c - clients), why);
+    }
+    c->state = STATE_IDLE;
+    set_timer(c, now_seconds() + RECONNECT_INTERVAL);
+}
+/*---------------------------------------------------------------------------*/
+/* Readings as get_onboard_temp() and get_onboard_hum(), in hundredths */
+static void
+publish_reading(client_t *c, double now)
+{
+    char text[160];
+    uint8_t record[22];
+    uint16_t interval = opt.interval < 1 ? 1 : opt.interval;
+    int16_t temp = 1600 + next_random(c) % 1901;
+    uint16_t hum = 5600 + next_random(c) % 1901;
+    uint8_t slot;
+
+    c->seq++;
+    if(opt.binary) {
+        /* As build_binary_payload(), one reading of age 0, route fe80::1 */
+        memset(record, 0, sizeof(record));
+        record[0] = PAYLOAD_BINARY_VERSION;
+        record[1] = 1;
+        record[2] = c->node_id & 0xFF;
+        record[3] = c->node_id >> 8;
+        record[4] = c->seq & 0xFF;
+        record[5] = c->seq >> 8;
+        record[13] = 1;
+        record[14] = interval & 0xFF;
+        record[15] = interval >> 8;
+        record[18] = temp & 0xFF;
+        record[19] = temp >> 8;
+        record[20] = hum & 0xFF;
+        record[21] = hum >> 8;
+        send_publish(c, c->pub_topic, record, sizeof(record));
+    } else {
+        char id[32];
+
+        client_py_id(c, id, sizeof(id));
+        snprintf(text, sizeof(text),
+                 "{\"d\":{\"s_id\":\"%s\",\"seq\":%u,\"temp_c\":%d.%02d,\"hum\":%u.%02u,\"interval\":%u,\"Def Route\":\"%s\"}}",
+                 id, c->seq, temp / 100, temp % 100, hum / 100, hum % 100, interval, DEF_ROUTE);
+        send_publish(c, c->pub_topic, text, strlen(text));
+    }
+
+    slot = c->seq % SENT_SLOTS;
+    c->sent_seq[slot] = c->seq;
+    c->sent_time[slot] = now;
+    published++;
+}
+/*---------------------------------------------------------------------------*/
+/* A reading back on the monitor: node id and seq give its send time */
+static void
+monitor_reading(const uint8_t *payload, size_t len, double now)
+{
+    char text[256];
+    const char *p;
+    unsigned long node_id;
+    unsigned long seq;
+    client_t *c;
+    uint8_t slot;
+
+    if(len >= 6 && payload[0] == PAYLOAD_BINARY_VERSION) {
+        node_id = payload[2] | (payload[3] << 8);
+        seq = payload[4] | (payload[5] << 8);
+    } else {
+        if(len >= sizeof(text)) {
+            len = sizeof(text) - 1;
+        }
+        memcpy(text, payload, len);
+        text[len] = '\0';
+        p = strstr(text, "\"s_id\":\"" DEFAULT_ORG_ID "-");
+        if(p == NULL) {
+            return;
+        }
+        node_id = strtoul(p + strlen("\"s_id\":\"" DEFAULT_ORG_ID "-"), NULL, 16);
+        p = strstr(text, "\"seq\":");
+        if(p == NULL) {
+            return;
+        }
+        seq = strtoul(p + strlen("\"seq\":"), NULL, 10);
+    }
+
+    /* Readings of motes of another run or of real motes are not ours */
+    if(node_id < 1 || node_id > opt.motes) {
+        return;
+    }
+    c = &clients[node_id - 1];
+    slot = seq % SENT_SLOTS;
+    if(c->sent_seq[slot] == seq && c->sent_time[slot] > 0) {
+        samples_add(&latencies, now - c->sent_time[slot]);
+        c->sent_time[slot] = 0;
+        received++;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* N/B/F/R of mote n: neighborhoods A-D, buildings 0-3, floors S, 0-2 */
+static void
+location_of(unsigned long node_id, char *out, size_t size)
+{
+    static const char neighborhoods[] = "ABCD";
+    static const char floors[] = "S012";
+    unsigned long k = node_id - 1;
+
+    snprintf(out, size, "%c/%lu/%c/%lu", neighborhoods[k % 4], (k / 4) % 4, floors[(k / 16) % 4], k / 64 + 1);
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_publish(client_t *c, const uint8_t *data, size_t len, uint8_t flags, double now)
+{
+    char topic[128];
+    char id[32];
+    char location[32];
+    size_t topic_len;
+    size_t offset;
+    const char *p;
+
+    if(len < 2) {
+        return;
+    }
+    topic_len = (data[0] << 8) | data[1];
+    offset = 2 + topic_len + ((flags & 0x06) ? 2 : 0);
+    if(offset > len || topic_len >= sizeof(topic)) {
+        return;
+    }
+    memcpy(topic, data + 2, topic_len);
+    topic[topic_len] = '\0';
+    data += offset;
+    len -= offset;
+
+    if(c->role == ROLE_MONITOR) {
+        monitor_reading(data, len, now);
+    } else if(c->role == ROLE_CONFIGURATOR) {
+        /* As sensor_configurator.py: the location of the id on conf/<id> */
+        if(len >= sizeof(id) || len <= strlen(DEFAULT_ORG_ID "-")) {
+            return;
+        }
+        memcpy(id, data, len);
+        id[len] = '\0';
+        if(strncmp(id, DEFAULT_ORG_ID "-", strlen(DEFAULT_ORG_ID "-")) != 0) {
+            return;
+        }
+        location_of(strtoul(id + strlen(DEFAULT_ORG_ID "-"), NULL, 16), location, sizeof(location));
+        snprintf(topic, sizeof(topic), SUB_CONF_TOPIC "%s", id);
+        send_publish(c, topic, location, strlen(location));
+    } else if(c->state == STATE_LISTENING) {
+        /* As pub_handler(): the payload is the location */
+        client_py_id(c, id, sizeof(id));
+        p = topic + strlen(SUB_CONF_TOPIC);
+        if(strncmp(topic, SUB_CONF_TOPIC, strlen(SUB_CONF_TOPIC)) != 0 || strcmp(p, id) != 0 ||
+           len + strlen(PUBLISH_LOCATION) >= sizeof(c->pub_topic)) {
+            return;
+        }
+        memcpy(c->pub_topic, PUBLISH_LOCATION, strlen(PUBLISH_LOCATION));
+        memcpy(c->pub_topic + strlen(PUBLISH_LOCATION), data, len);
+        c->pub_topic[strlen(PUBLISH_LOCATION) + len] = '\0';
+
+        put_u16(++c->packet_id);
+        put_string(topic);
+        send_packet(c, MQTT_UNSUBSCRIBE);
+
+        samples_add(&handshakes, now - c->started);
+        registered++;
+        c->state = STATE_PUBLISHING;
+        c->next_publish = now + opt.interval * (next_random(c) % 1000) / 1000.0;
+        set_timer(c, c->next_publish);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_packet(client_t *c, uint8_t type, const uint8_t *data, size_t len, double now)
+{
+    char topic[64];
+    char id[32];
+
+    switch(type & 0xF0) {
+        case MQTT_CONNACK:
+            if(len < 2 || data[1] != 0) {
+                client_failed(c, "connection refused");
+                return;
+            }
+            connected++;
+            if(c->role == ROLE_MONITOR) {
+                send_subscribe(c, PUBLISH_LOCATION "#");
+            } else if(c->role == ROLE_CONFIGURATOR) {
+                send_subscribe(c, PUBLISH_CONF_TOPIC);
+            } else {
+                client_py_id(c, id, sizeof(id));
+                snprintf(topic, sizeof(topic), SUB_CONF_TOPIC "%s", id);
+                send_subscribe(c, topic);
+            }
+            c->state = STATE_SUBACK;
+            break;
+        case MQTT_SUBACK:
+            if(c->role != ROLE_MOTE) {
+                c->state = STATE_READY;
+                set_timer(c, now + keep_alive() / 2.0);
+                break;
+            }
+            /* As publish_conf(): the id on the conf topic */
+            client_py_id(c, id, sizeof(id));
+            send_publish(c, PUBLISH_CONF_TOPIC, id, strlen(id));
+            c->state = STATE_LISTENING;
+            set_timer(c, now + opt.interval);
+            break;
+        case MQTT_PUBLISH:
+            handle_publish(c, data, len, type & 0x0F, now);
+            break;
+        default:
+            /* UNSUBACK, PINGRESP */
+            break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_input(client_t *c, double now)
+{
+    uint8_t chunk[16384];
+    ssize_t n;
+    size_t offset;
+    size_t remaining;
+    size_t header_len;
+    int shift;
+
+    for(;;) {
+        n = recv(c->fd, chunk, sizeof(chunk), 0);
+        if(n == 0) {
+            client_failed(c, "closed by the broker");
+            return;
+        }
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            client_failed(c, strerror(errno));
+            return;
+        }
+        buffer_append(&c->in, chunk, n);
+    }
+
+    offset = 0;
+    while(c->in.len - offset >= 2) {
+        remaining = 0;
+        shift = 0;
+        header_len = 1;
+        do {
+            if(offset + header_len >= c->in.len) {
+                goto incomplete;
+            }
+            remaining |= (size_t)(c->in.data[offset + header_len] & 0x7F) << shift;
+            shift += 7;
+        } while(c->in.data[offset + header_len++] & 0x80);
+        if(offset + header_len + remaining > c->in.len) {
+            break;
+        }
+        handle_packet(c, c->in.data[offset], c->in.data + offset + header_len, remaining, now);
+        if(c->fd < 0) {
+            return;
+        }
+        offset += header_len + remaining;
+    }
+incomplete:
+    buffer_consume(&c->in, offset);
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_event(client_t *c, uint32_t events, double now)
+{
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+
+    if(c->state == STATE_CONNECTING) {
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            return;
+        }
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+        if(error != 0) {
+            client_failed(c, strerror(error));
+            return;
+        }
+        send_connect(c);
+        return;
+    }
+    if(events & EPOLLIN) {
+        handle_input(c, now);
+    } else if(events & (EPOLLERR | EPOLLHUP)) {
+        client_failed(c, "connection error");
+        return;
+    }
+    if(c->fd >= 0 && (events & EPOLLOUT)) {
+        flush_out(c);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_timer(client_t *c, double now)
+{
+    switch(c->state) {
+        case STATE_IDLE:
+            open_connection(c);
+            break;
+        case STATE_LISTENING:
+            /* Still no location: keep the connection alive */
+            send_packet(c, MQTT_PINGREQ);
+            set_timer(c, now + opt.interval);
+            break;
+        case STATE_PUBLISHING:
+            if(c->next_publish < end_time) {
+                publish_reading(c, now);
+                c->next_publish += opt.interval;
+                set_timer(c, c->next_publish);
+                break;
+            }
+            /* No more readings: only keep the connection alive */
+            send_packet(c, MQTT_PINGREQ);
+            set_timer(c, now + keep_alive() / 2.0);
+            break;
+        case STATE_READY:
+            /* The monitor and the configurator only receive: ping the broker */
+            send_packet(c, MQTT_PINGREQ);
+            set_timer(c, now + keep_alive() / 2.0);
+            break;
+        default:
+            break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static int
+resolve_broker(void)
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    int rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    rc = getaddrinfo(opt.broker, opt.port, &hints, &result);
+    if(rc != 0) {
+        fprintf(stderr, "Cannot resolve %s: %s\n", opt.broker, gai_strerror(rc));
+        return 0;
+    }
+    memcpy(&broker_addr, result->ai_addr, result->ai_addrlen);
+    broker_addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* One descriptor per connection: raise the limit as far as allowed */
+static int
+enough_descriptors(unsigned int needed)
+{
+    struct rlimit limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 1;
+    }
+    if(limit.rlim_cur < needed && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max < needed ? limit.rlim_max : needed;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if(limit.rlim_cur < needed) {
+        fprintf(stderr, "%u motes need %u descriptors, the limit is %lu (ulimit -n)\n",
+                opt.motes, needed, (unsigned long)limit.rlim_cur);
+        return 0;
+    }
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+on_signal(int signal)
+{
+    (void)signal;
+    interrupted = 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-b broker] [-p port] [-n motes] [-i interval s] [-d duration s]\n"
+            "          [-r connections/s] [-c] [-B]\n"
+            "  -c  answer the registrations on " PUBLISH_CONF_TOPIC " (no configurator running)\n"
+            "  -B  publish the binary payload of PAYLOAD_BINARY instead of JSON\n", name);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+    struct epoll_event events[256];
+    double start;
+    double now;
+    double next_report;
+    double stop;
+    unsigned long last_published = 0;
+    unsigned int i;
+    int timeout;
+    int n;
+    int c;
+
+    while((c = getopt(argc, argv, "b:p:n:i:d:r:cB")) != -1) {
+        switch(c) {
+            case 'b': opt.broker = optarg; break;
+            case 'p': opt.port = optarg; break;
+            case 'n': opt.motes = strtoul(optarg, NULL, 10); break;
+            case 'i': opt.interval = atof(optarg); break;
+            case 'd': opt.duration = atof(optarg); break;
+            case 'r': opt.ramp = atof(optarg); break;
+            case 'c': opt.configure = 1; break;
+            case 'B': opt.binary = 1; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind != argc || opt.motes < 1 || opt.motes > 0xFFFF || opt.interval <= 0 ||
+       opt.duration <= 0 || opt.ramp <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(!resolve_broker() || !enough_descriptors(opt.motes + 16)) {
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    epoll_fd = epoll_create1(0);
+    /* Motes 1..n, then the monitor and the configurator */
+    client_count = opt.motes + 1 + opt.configure;
+    clients = calloc(client_count, sizeof(client_t));
+    if(epoll_fd < 0 || clients == NULL) {
+        perror("mqtt-loadgen");
+        return 1;
+    }
+
+    start = now_seconds();
+    for(i = 0; i < client_count; i++) {
+        clients[i].fd = -1;
+        clients[i].random = 2463534242u ^ (i * 2654435761u);
+        if(i < opt.motes) {
+            clients[i].role = ROLE_MOTE;
+            clients[i].node_id = i + 1;
+            /* The monitor and the configurator first, then ramp connections per second */
+            set_timer(&clients[i], start + 0.1 + i / opt.ramp);
+        } else {
+            clients[i].role = i == opt.motes ? ROLE_MONITOR : ROLE_CONFIGURATOR;
+            open_connection(&clients[i]);
+        }
+    }
+
+    /* The readings stop at the end; one more second for the last ones to arrive */
+    end_time = start + opt.duration;
+    stop = end_time + 1;
+    next_report = start + 5;
+    printf("%u motes on %s:%s, a reading every %.3f s for %.0f s\n",
+           opt.motes, opt.broker, opt.port, opt.interval, opt.duration);
+
+    while(!interrupted && (now = now_seconds()) < stop) {
+        timeout = 100;
+        if(timer_count > 0) {
+            double wait = (timers[0].time - now) * 1000;
+            timeout = wait <= 0 ? 0 : wait < timeout ? (int)wait + 1 : timeout;
+        }
+        n = epoll_wait(epoll_fd, events, 256, timeout);
+        now = now_seconds();
+        for(c = 0; c < n; c++) {
+            client_t *client = &clients[events[c].data.u32];
+            if(client->fd >= 0) {
+                handle_event(client, events[c].events, now);
+            }
+            if(client->fd >= 0 && client->broken != NULL) {
+                client_failed(client, client->broken);
+            }
+        }
+
+        while(timer_count > 0 && timers[0].time <= now) {
+            timer_entry_t entry = pop_timer();
+            client_t *client = &clients[entry.client];
+            if(entry.gen == client->timer_gen) {
+                handle_timer(client, now);
+                if(client->fd >= 0 && client->broken != NULL) {
+                    client_failed(client, client->broken);
+                }
+            }
+        }
+
+        if(now >= next_report) {
+            printf("%6.0f s: connected %u, registered %u, published %lu (%.0f/s), received %lu, errors %lu\n",
+                   now - start, connected, registered, published, (published - last_published) / 5.0,
+                   received, errors);
+            fflush(stdout);
+            last_published = published;
+            next_report += 5;
+        }
+    }
+
+    printf("Motes: %u, registered %u, connection errors %lu\n", opt.motes, registered, errors);
+    printf("Published: %lu in %.0f s (%.1f/s)\n", published, opt.duration, published / opt.duration);
+    printf("Received: %lu (%.2f%%)\n", received, published ? 100.0 * received / published : 0);
+    print_percentiles("Latency", &latencies);
+    print_percentiles("Registration", &handshakes);
+
+    for(i = 0; i < client_count; i++) {
+        if(clients[i].fd >= 0) {
+            close(clients[i].fd);
+        }
+        free(clients[i].in.data);
+        free(clients[i].out.data);
+    }
+    free(clients);
+    free(timers);
+    free(latencies.values);
+    free(handshakes.values);
+    close(epoll_fd);
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -52,6 +52,7 @@
 #define LOG_MODULE "MQTT-MOTE"
 #define LOG_LEVEL LOG_LEVEL_INFO
 
+#include <stdarg.h>
 #include <string.h>
 /*---------------------------------------------------------------------------*/
 /*
@@ -150,8 +151,6 @@ static char client_py_id[BUFFER_SIZE];
 static char pub_topic[BUFFER_SIZE];
 static char sub_topic[BUFFER_SIZE];
 static char location_topic[BUFFER_SIZE];
-static char value_temp[6];
-static char value_hum[6];
 /*---------------------------------------------------------------------------*/
 /*
  * The main MQTT buffers.
@@ -172,6 +171,41 @@ static int id_not_yet_set = 1;
 /*---------------------------------------------------------------------------*/
 static mqtt_client_config_t conf;
 /*---------------------------------------------------------------------------*/
+/*
+ * Readings waiting to be published, in a ring buffer twice as long as a batch
+ * so that the next batch can fill while one cannot be sent yet. Values are in
+ * hundredths, times in seconds of the mote clock.
+ */
+#if BATCH_SIZE < 1 || BATCH_SIZE > 16
+#error "BATCH_SIZE must be between 1 and 16"
+#endif
+#define READING_BUFFER_SIZE (2 * BATCH_SIZE)
+typedef struct reading {
+    unsigned long time;
+    uint16_t seq;
+    int16_t temp;
+    int16_t hum;
+} reading_t;
+static reading_t readings[READING_BUFFER_SIZE];
+static uint8_t readings_first;
+static uint8_t readings_count;
+/* Expires when the next reading is due */
+static struct timer reading_timer;
+/* pub_interval, stretched by ADAPTIVE_INTERVAL while the link is congested */
+static clock_time_t reading_interval;
+#if ADAPTIVE_INTERVAL
+static struct ctimer send_check;
+/* Set once congestion was seen for the batch waiting to be published */
+static uint8_t congested;
+#endif
+#if DEADBAND
+/* The last reading kept, that the next ones are compared with */
+static int16_t kept_temp;
+static int16_t kept_hum;
+static unsigned long kept_time;
+static uint8_t kept_any;
+#endif
+/*---------------------------------------------------------------------------*/
 PROCESS(mqtt_mote_process, "MQTT mote");
 /*---------------------------------------------------------------------------*/
 int
@@ -363,6 +397,9 @@ update_config(int id_not_yet_set)
             state = STATE_CONFIG_ERROR;
             return;
         }
+        /* The first reading is taken as soon as we publish */
+        timer_set(&reading_timer, 0);
+        reading_interval = conf.pub_interval;
     }
 
     /* Reset the counter */
@@ -397,6 +434,7 @@ init_config()
 
     conf.broker_port = DEFAULT_BROKER_PORT;
     conf.pub_interval = DEFAULT_PUBLISH_INTERVAL;
+    reading_interval = conf.pub_interval;
 }
 /*---------------------------------------------------------------------------*/
 static void
@@ -430,63 +468,338 @@ get_onboard_hum(void)
     return (min + 1) + (((float) rand()) / (float) RAND_MAX) * (max - (min + 1));
 }
 /*---------------------------------------------------------------------------*/
+static int16_t
+to_hundredths(float value)
+{
+    return (int16_t)(value >= 0 ? value * 100 + 0.5f : value * 100 - 0.5f);
+}
+/*---------------------------------------------------------------------------*/
+#if DEADBAND
+static uint16_t
+distance(int16_t a, int16_t b)
+{
+    return a > b ? a - b : b - a;
+}
+/*---------------------------------------------------------------------------*/
+/* Whether a reading must be reported: it left the deadband or the mote was silent too long */
+static int
+outside_deadband(int16_t temp, int16_t hum, unsigned long now)
+{
+    return !kept_any ||
+           distance(temp, kept_temp) > DEADBAND_TEMP ||
+           distance(hum, kept_hum) > DEADBAND_HUM ||
+           now - kept_time >= DEADBAND_MAX_SILENCE;
+}
+#endif
+/*---------------------------------------------------------------------------*/
 static void
-publish(void)
+take_reading(void)
 {
-    int len;
-    int remaining = APP_BUFFER_SIZE;
+    reading_t *reading;
+    unsigned long now = clock_seconds();
+    int16_t temp = to_hundredths(get_onboard_temp());
+    int16_t hum = to_hundredths(get_onboard_hum());
+
+#if DEADBAND
+    if(!outside_deadband(temp, hum, now)) {
+        LOG_INFO("Reading within the deadband, not reported\n");
+        return;
+    }
+    kept_temp = temp;
+    kept_hum = hum;
+    kept_time = now;
+    kept_any = 1;
+#endif
+
+    if(readings_count == READING_BUFFER_SIZE) {
+        LOG_WARN("Reading buffer full, dropping seq %u\n", readings[readings_first].seq);
+        readings_first = (readings_first + 1) % READING_BUFFER_SIZE;
+        readings_count--;
+    }
 
-    snprintf(value_temp, 6, "%.2f", get_onboard_temp());
-    value_temp[2] = '.';
-    snprintf(value_hum, 6, "%.2f", get_onboard_hum());
-    value_hum[2] = '.';
+    reading = &readings[(readings_first + readings_count) % READING_BUFFER_SIZE];
+    reading->time = now;
+    reading->seq = ++seq_nr_value;
+    reading->temp = temp;
+    reading->hum = hum;
+    readings_count++;
+}
+/*---------------------------------------------------------------------------*/
+static unsigned long
+oldest_reading_age(void)
+{
+    return clock_seconds() - readings[readings_first].time;
+}
+/*---------------------------------------------------------------------------*/
+static int
+batch_due(void)
+{
+    return readings_count >= BATCH_SIZE ||
+           (readings_count > 0 && oldest_reading_age() >= BATCH_MAX_LATENCY);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Time until the next reading or until the oldest reading must be published,
+ * at least one tick so that the state machine never re-enters itself at once
+ */
+static clock_time_t
+next_wakeup(void)
+{
+    clock_time_t next = timer_remaining(&reading_timer);
+    clock_time_t deadline;
+
+    if(readings_count > 0) {
+        deadline = oldest_reading_age() >= BATCH_MAX_LATENCY ? 0 :
+                   (BATCH_MAX_LATENCY - oldest_reading_age()) * CLOCK_SECOND;
+        if(deadline < next) {
+            next = deadline;
+        }
+    }
 
-    seq_nr_value++;
+    return next > 0 ? next : 1;
+}
+/*---------------------------------------------------------------------------*/
+#if ADAPTIVE_INTERVAL
+static void
+stretch_interval(const char *reason)
+{
+    clock_time_t max = conf.pub_interval * PUB_INTERVAL_MAX_FACTOR;
 
-    buf_ptr = app_buffer;
+    congested = 1;
+    if(reading_interval < max) {
+        reading_interval = reading_interval * 2 < max ? reading_interval * 2 : max;
+        LOG_WARN("%s, reading interval now %lu s\n", reason,
+                 (unsigned long)(reading_interval / CLOCK_SECOND));
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void
+shrink_interval(void)
+{
+    if(reading_interval > conf.pub_interval) {
+        reading_interval = reading_interval * 3 / 4 > conf.pub_interval ?
+                           reading_interval * 3 / 4 : conf.pub_interval;
+        LOG_INFO("Link healthy, reading interval now %lu s\n",
+                 (unsigned long)(reading_interval / CLOCK_SECOND));
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* SLOW_SEND_TIME after a publish: was the message handed to TCP and acked? */
+static void
+check_send(void *ptr)
+{
+    if(conn.out_buffer_sent && !conn.out_queue_full) {
+        shrink_interval();
+    } else {
+        stretch_interval("Slow send");
+    }
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#if PAYLOAD_FORMAT == PAYLOAD_BINARY
+static uint8_t *
+put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+    return out + 2;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * The n oldest readings as a little-endian record:
+ *   0  u8   PAYLOAD_BINARY_VERSION (never '{', so it cannot be taken for JSON)
+ *   1  u8   n
+ *   2  u16  node id (last two bytes of the link address, as in s_id)
+ *   4  u16  seq of the first reading
+ *   6  u8[8] interface identifier of the default route (fe80::/64)
+ *   14 u16  current reading interval in seconds
+ *   16 n times: u16 age in seconds at the time of sending,
+ *               i16 temperature and u16 humidity in hundredths
+ */
+#define PAYLOAD_BINARY_VERSION 2
+static int
+build_binary_payload(uint8_t n)
+{
+    uint8_t *out = (uint8_t *)app_buffer;
+    uip_ipaddr_t *def_rt = uip_ds6_defrt_choose();
+    unsigned long now = clock_seconds();
+    unsigned long age;
+    reading_t *reading;
+    uint8_t i;
+
+    *out++ = PAYLOAD_BINARY_VERSION;
+    *out++ = n;
+    out = put_u16(out, (linkaddr_node_addr.u8[6] << 8) | linkaddr_node_addr.u8[7]);
+    out = put_u16(out, readings[readings_first].seq);
+    if(def_rt != NULL) {
+        memcpy(out, &def_rt->u8[8], 8);
+    } else {
+        memset(out, 0, 8);
+    }
+    out += 8;
+    out = put_u16(out, reading_interval / CLOCK_SECOND);
+
+    for(i = 0; i < n; i++) {
+        reading = &readings[(readings_first + i) % READING_BUFFER_SIZE];
+        age = now - reading->time;
+        out = put_u16(out, age > 0xFFFF ? 0xFFFF : age);
+        out = put_u16(out, (uint16_t)reading->temp);
+        out = put_u16(out, (uint16_t)reading->hum);
+    }
+
+    return out - (uint8_t *)app_buffer;
+}
+/*---------------------------------------------------------------------------*/
+#else
+/* Append to app_buffer at buf_ptr; returns 0 if it does not fit */
+static int
+app_printf(int *remaining, const char *format, ...)
+{
+    va_list args;
+    int len;
 
-    len = snprintf(buf_ptr, remaining,
-                   "{"
-                   "\"d\":{"
-                   "\"s_id\":\"%s\","
-		   "\"seq\":%d,"
-                   "\"temp_c\":%s,"
-                   "\"hum\":%s",
-                   client_py_id, seq_nr_value, value_temp, value_hum);
+    va_start(args, format);
+    len = vsnprintf(buf_ptr, *remaining, format, args);
+    va_end(args);
 
-    if(len < 0 || len >= remaining) {
-        LOG_ERR("Buffer too short. Have %d, need %d + \\0\n", remaining, len);
-        return;
+    if(len < 0 || len >= *remaining) {
+        LOG_ERR("Buffer too short. Have %d, need %d + \\0\n", *remaining, len);
+        return 0;
     }
 
-    remaining -= len;
+    *remaining -= len;
     buf_ptr += len;
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* A value in hundredths as a decimal number with two digits, e.g. 25.07 */
+static int
+app_printf_hundredths(int *remaining, const char *prefix, int16_t value)
+{
+    unsigned int magnitude = value < 0 ? -value : value;
+
+    return app_printf(remaining, "%s%s%u.%02u", prefix, value < 0 ? "-" : "",
+                      magnitude / 100, magnitude % 100);
+}
+/*---------------------------------------------------------------------------*/
+static int
+build_json_payload(uint8_t n)
+{
+    int remaining = APP_BUFFER_SIZE;
+    reading_t *first = &readings[readings_first];
+
+    buf_ptr = app_buffer;
+
+#if BATCH_SIZE == 1
+    if(!app_printf(&remaining, "{\"d\":{\"s_id\":\"%s\",\"seq\":%u", client_py_id, first->seq) ||
+       !app_printf_hundredths(&remaining, ",\"temp_c\":", first->temp) ||
+       !app_printf_hundredths(&remaining, ",\"hum\":", first->hum)) {
+        return 0;
+    }
+#else
+    uint8_t i;
+
+    /*
+     * One message for n readings: seq and t0 (seconds of the mote clock) of
+     * the first one, the seconds between consecutive readings in dt and the
+     * clock at the time of sending in tx, so that the receiver can date them
+     */
+    if(!app_printf(&remaining, "{\"d\":{\"s_id\":\"%s\",\"seq\":%u,\"n\":%u,\"t0\":%lu,\"tx\":%lu,\"dt\":[",
+                   client_py_id, first->seq, n, first->time, clock_seconds())) {
+        return 0;
+    }
+    for(i = 1; i < n; i++) {
+        if(!app_printf(&remaining, i > 1 ? ",%lu" : "%lu",
+                       readings[(readings_first + i) % READING_BUFFER_SIZE].time -
+                       readings[(readings_first + i - 1) % READING_BUFFER_SIZE].time)) {
+            return 0;
+        }
+    }
+    if(!app_printf(&remaining, "],\"temp_c\":[")) {
+        return 0;
+    }
+    for(i = 0; i < n; i++) {
+        if(!app_printf_hundredths(&remaining, i > 0 ? "," : "",
+                                  readings[(readings_first + i) % READING_BUFFER_SIZE].temp)) {
+            return 0;
+        }
+    }
+    if(!app_printf(&remaining, "],\"hum\":[")) {
+        return 0;
+    }
+    for(i = 0; i < n; i++) {
+        if(!app_printf_hundredths(&remaining, i > 0 ? "," : "",
+                                  readings[(readings_first + i) % READING_BUFFER_SIZE].hum)) {
+            return 0;
+        }
+    }
+    if(!app_printf(&remaining, "]")) {
+        return 0;
+    }
+#endif
 
     char def_rt_str[64];
     memset(def_rt_str, 0, sizeof(def_rt_str));
     ipaddr_sprintf(def_rt_str, sizeof(def_rt_str), uip_ds6_defrt_choose());
 
-    len = snprintf(buf_ptr, remaining, ",\"Def Route\":\"%s\"",
-                   def_rt_str);
-
-    if(len < 0 || len >= remaining) {
-        LOG_ERR("Buffer too short. Have %d, need %d + \\0\n", remaining, len);
-        return;
+    if(!app_printf(&remaining, ",\"interval\":%lu,\"Def Route\":\"%s\"}}",
+                   (unsigned long)(reading_interval / CLOCK_SECOND), def_rt_str)) {
+        return 0;
     }
-    remaining -= len;
-    buf_ptr += len;
 
-    len = snprintf(buf_ptr, remaining, "}}");
+    return buf_ptr - app_buffer;
+}
+#endif
+/*---------------------------------------------------------------------------*/
+/* Returns 1 if the oldest readings were handed to MQTT, 0 to retry later */
+static int
+publish(void)
+{
+    uint8_t n = readings_count < BATCH_SIZE ? readings_count : BATCH_SIZE;
+    mqtt_status_t status;
+    int len;
 
-    if(len < 0 || len >= remaining) {
-        LOG_ERR("Buffer too short. Have %d, need %d + \\0\n", remaining, len);
-        return;
+#if PAYLOAD_FORMAT == PAYLOAD_BINARY
+    len = build_binary_payload(n);
+#else
+    /*
+     * A batch whose JSON does not fit in app_buffer (large times, extreme
+     * values) is sent in smaller parts: halve it until it fits, the rest goes
+     * in the next publish. A reading that never fits is dropped.
+     */
+    while((len = build_json_payload(n)) == 0 && n > 1) {
+        n /= 2;
+    }
+#endif
+    if(len == 0) {
+        LOG_ERR("Reading seq %u does not fit in app_buffer, dropped\n", readings[readings_first].seq);
+        readings_first = (readings_first + 1) % READING_BUFFER_SIZE;
+        readings_count--;
+        return 0;
     }
 
-    mqtt_publish(&conn, NULL, pub_topic, (uint8_t *)app_buffer,
-                 strlen(app_buffer), MQTT_QOS_LEVEL_0, MQTT_RETAIN_OFF);
+    status = mqtt_publish(&conn, NULL, pub_topic, (uint8_t *)app_buffer,
+                          len, MQTT_QOS_LEVEL_0, MQTT_RETAIN_OFF);
+    if(status != MQTT_STATUS_OK) {
+        LOG_WARN("Publish failed, %u readings kept\n", readings_count);
+#if ADAPTIVE_INTERVAL
+        if(status == MQTT_STATUS_OUT_QUEUE_FULL) {
+            stretch_interval("Out queue full");
+        }
+#endif
+        return 0;
+    }
 
-    LOG_INFO("Publish sent out!\n");
+#if ADAPTIVE_INTERVAL
+    congested = 0;
+    ctimer_set(&send_check, SLOW_SEND_TIME * CLOCK_SECOND, check_send, NULL);
+#endif
+
+    readings_first = (readings_first + n) % READING_BUFFER_SIZE;
+    readings_count -= n;
+
+    LOG_INFO("Publish sent out! (%u readings, %d bytes)\n", n, len);
+    return 1;
 }
 /*---------------------------------------------------------------------------*/
 static void
@@ -605,17 +918,41 @@ state_machine(void)
                 connect_attempt = 0;
             }
 
+            /*
+             * A reading every reading_interval (unless DEADBAND drops it),
+             * published when its batch is due
+             */
+            if(timer_expired(&reading_timer)) {
+                take_reading();
+                timer_set(&reading_timer, reading_interval);
+            }
+
+            if(!batch_due()) {
+                etimer_set(&publish_periodic_timer, next_wakeup());
+                return;
+            }
+
             if(mqtt_ready(&conn) && conn.out_buffer_sent) {
                 leds_on(STATUS_LED);
                 ctimer_set(&ct, PUBLISH_LED_ON_DURATION, publish_led_off, NULL);
-                publish();
-
-                etimer_set(&publish_periodic_timer, conf.pub_interval);
+                if(publish()) {
+                    etimer_set(&publish_periodic_timer, next_wakeup());
 
-                LOG_INFO("Publishing\n");
-                return;
+                    LOG_INFO("Publishing\n");
+                    return;
+                }
+                /* Not sent: retry with the periodic timer below */
             } else {
                 LOG_INFO("Publishing... (MQTT state=%d, q=%u)\n", conn.state, conn.out_queue_full);
+#if ADAPTIVE_INTERVAL
+                /*
+                 * A batch is due but the last message is not out yet; not
+                 * congestion while disconnected or reconnecting
+                 */
+                if(!congested && mqtt_ready(&conn) && !conn.out_buffer_sent) {
+                    stretch_interval("MQTT not ready");
+                }
+#endif
             }
             break;
         case STATE_DISCONNECTED:
@@ -49,6 +49,47 @@
 #define SUB_CONF_TOPIC       "mtds/sensor/conf/"
 
 #define BROKER_IP_ADDR "fd00::1"
+
+/*
+ * Batching: a reading is taken every pub_interval and kept in a ring buffer,
+ * then BATCH_SIZE readings are published in one message, or fewer when the
+ * oldest one has waited BATCH_MAX_LATENCY seconds. With BATCH_SIZE 1 every
+ * reading is published on its own, in the original format.
+ */
+#define BATCH_SIZE           1
+#define BATCH_MAX_LATENCY    300
+
+/*
+ * Payload encoding: PAYLOAD_JSON is the text message, PAYLOAD_BINARY a
+ * little-endian record of integers (layout in mqtt-mote.c, decoder in
+ * Python Servers/sensor_payload.py), 16 bytes plus 6 per reading.
+ */
+#define PAYLOAD_JSON         0
+#define PAYLOAD_BINARY       1
+#define PAYLOAD_FORMAT       PAYLOAD_JSON
+
+/*
+ * Adaptive interval: with ADAPTIVE_INTERVAL 1 the interval of the readings
+ * is doubled, up to PUB_INTERVAL_MAX_FACTOR times pub_interval, when the MQTT
+ * out queue is full or a message is still unsent SLOW_SEND_TIME seconds
+ * after publishing, and brought back towards pub_interval as messages are
+ * sent in time. The current interval is in every payload. Off by default:
+ * the tables computed from the readings assume one every pub_interval.
+ */
+#define ADAPTIVE_INTERVAL       0
+#define PUB_INTERVAL_MAX_FACTOR 8
+#define SLOW_SEND_TIME          5
+
+/*
+ * Report by exception: with DEADBAND 1 a reading is kept for publishing only
+ * when temperature or humidity moved more than DEADBAND_TEMP / DEADBAND_HUM
+ * (hundredths) from the last reading kept, or when none was kept for
+ * DEADBAND_MAX_SILENCE seconds. With DEADBAND 0 every reading is kept.
+ */
+#define DEADBAND             0
+#define DEADBAND_TEMP        20
+#define DEADBAND_HUM         100
+#define DEADBAND_MAX_SILENCE 900
 //*---------------------------------------------------------------------------*/
 #define IEEE802154_CONF_DEFAULT_CHANNEL      21
 //*---------------------------------------------------------------------------*/
@@ -0,0 +1,55 @@
+import argparse
+import bisect
+import itertools
+import random
+import string
+
+
+def make_vocabulary(size, rnd):
+    # Distinct pseudo-words of 2 to 12 lowercase letters
+    vocabulary = []
+    seen = set()
+    while len(vocabulary) < size:
+        word = "".join(rnd.choice(string.ascii_lowercase) for _ in range(rnd.randint(2, 12)))
+        if word not in seen:
+            seen.add(word)
+            vocabulary.append(word)
+    return vocabulary
+
+
+def zipf_cumulative_weights(size, exponent):
+    # The word of rank k is drawn with probability proportional to 1 / k^exponent
+    return list(itertools.accumulate(1.0 / (k ** exponent) for k in range(1, size + 1)))
+
+
+def write_corpus(path, tokens, vocabulary, exponent, words_per_line, rnd):
+    cumulative = zipf_cumulative_weights(len(vocabulary), exponent)
+    total = cumulative[-1]
+    written = 0
+    with open(path, "w") as out:
+        while written < tokens:
+            line = min(words_per_line, tokens - written)
+            words = [vocabulary[bisect.bisect_left(cumulative, rnd.random() * total)] for _ in range(line)]
+            out.write(" ".join(words))
+            out.write("\n")
+            written += line
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a Zipfian corpus for word_count")
+    parser.add_argument("output", help="file to write")
+    parser.add_argument("--tokens", type=int, default=1000000, help="number of words in the corpus")
+    parser.add_argument("--vocabulary", type=int, default=100000, help="number of distinct words")
+    parser.add_argument("--exponent", type=float, default=1.0, help="exponent of the Zipf distribution")
+    parser.add_argument("--words-per-line", type=int, default=16)
+    parser.add_argument("--seed", type=int, default=42)
+    args = parser.parse_args()
+
+    rnd = random.Random(args.seed)
+    vocabulary = make_vocabulary(args.vocabulary, rnd)
+    write_corpus(args.output, args.tokens, vocabulary, args.exponent, args.words_per_line, rnd)
+    print("Written %d words (%d distinct available) to %s" % (args.tokens, args.vocabulary, args.output))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,80 @@
+import argparse
+import csv
+import os
+import random
+import re
+import subprocess
+import sys
+
+from generate_corpus import make_vocabulary, write_corpus
+
+PHASES = ["map", "shuffle", "merge", "gather", "total"]
+TIMINGS = re.compile(r"Timings: ranks=(\d+) tokens=(\d+) " + " ".join(p + r"=([0-9.]+)" for p in PHASES))
+
+
+def run(binary, ranks, corpus, mpirun_args, repetitions):
+    # Keep the fastest of the repetitions, phase by phase
+    best = None
+    for _ in range(repetitions):
+        command = ["mpirun", "-np", str(ranks)] + mpirun_args + [binary, "--bench", "--mpiio", corpus]
+        output = subprocess.run(command, check=True, capture_output=True, text=True).stdout
+        match = TIMINGS.search(output)
+        if match is None:
+            sys.exit("No timings in the output of: " + " ".join(command))
+        times = [float(t) for t in match.groups()[2:]]
+        best = times if best is None else [min(a, b) for a, b in zip(best, times)]
+    return best
+
+
+def write_table(path, rows):
+    with open(path, "w", newline="") as out:
+        writer = csv.writer(out, delimiter=";")
+        writer.writerow(["ranks", "tokens"] + PHASES + ["speedup", "efficiency"])
+        writer.writerows(rows)
+    print("Written " + path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Strong and weak scaling of word_count")
+    parser.add_argument("--binary", default="./word_count")
+    parser.add_argument("--max-ranks", type=int, default=os.cpu_count())
+    parser.add_argument("--tokens", type=int, default=4000000,
+                        help="corpus size of the strong scaling, and per rank for the weak scaling")
+    parser.add_argument("--vocabulary", type=int, default=100000)
+    parser.add_argument("--exponent", type=float, default=1.0)
+    parser.add_argument("--repetitions", type=int, default=3)
+    parser.add_argument("--work-dir", default="scaling")
+    parser.add_argument("--mpirun-args", default="", help="extra arguments for mpirun (e.g. \"--oversubscribe\")")
+    args = parser.parse_args()
+
+    os.makedirs(args.work_dir, exist_ok=True)
+    mpirun_args = args.mpirun_args.split()
+    rnd = random.Random(42)
+    vocabulary = make_vocabulary(args.vocabulary, rnd)
+
+    # Strong scaling: the same corpus for every number of ranks
+    corpus = os.path.join(args.work_dir, "strong.txt")
+    write_corpus(corpus, args.tokens, vocabulary, args.exponent, 16, rnd)
+    rows = []
+    for ranks in range(1, args.max_ranks + 1):
+        times = run(args.binary, ranks, corpus, mpirun_args, args.repetitions)
+        speedup = rows[0][-3] / times[-1] if rows else 1.0
+        rows.append([ranks, args.tokens] + times + [speedup, speedup / ranks])
+        print("strong %d ranks: %s" % (ranks, times))
+    write_table(os.path.join(args.work_dir, "strong_scaling.csv"), rows)
+
+    # Weak scaling: the corpus grows with the number of ranks
+    rows = []
+    for ranks in range(1, args.max_ranks + 1):
+        corpus = os.path.join(args.work_dir, "weak%d.txt" % ranks)
+        write_corpus(corpus, args.tokens * ranks, vocabulary, args.exponent, 16, rnd)
+        times = run(args.binary, ranks, corpus, mpirun_args, args.repetitions)
+        efficiency = rows[0][-3] / times[-1] if rows else 1.0
+        rows.append([ranks, args.tokens * ranks] + times + [efficiency * ranks, efficiency])
+        print("weak %d ranks: %s" % (ranks, times))
+        os.remove(corpus)
+    write_table(os.path.join(args.work_dir, "weak_scaling.csv"), rows)
+
+
+if __name__ == "__main__":
+    main()
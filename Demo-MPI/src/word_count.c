@@ -3,44 +3,1258 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-#define max_size 11
+//Initial number of slots of the hash table (must be a power of two)
+#define map_initial_capacity 1024
+//Initial size in bytes of the arena that stores the words
+#define arena_initial_size 4096
+//Size of the blocks read when a file cannot be memory-mapped
+#define read_block_size (1 << 20)
+//Largest piece read by a single MPI_File_read_at_all call
+#define mpiio_piece_size (1 << 30)
+//Count-Min Sketch of the approximate mode: cms_depth rows of cms_width counters
+#define cms_depth 4
+#define cms_width (1 << 16)
+//HyperLogLog of the approximate mode: 2^hll_precision registers
+#define hll_precision 14
+//Smallest batch sent to a single rank by the out-of-core exchange
+#define spill_min_batch (64 * 1024)
+//Initial size of the buffers used to read the words of a run
+#define word_initial_size 64
 
-typedef struct pair_char_pair_t {
-    char c[max_size];
+//Packed wire format: the words travel concatenated (without terminator) in a
+//separate byte buffer, each header tells where its word starts inside the bytes
+//sent by the same rank and how many times the word occurs
+typedef struct word_header_t {
+    int offset;
     int count;
-} char_int_pair;
+} word_header;
+
+//Slot of the open addressing hash table, the word itself is stored in the arena
+typedef struct word_map_entry_t {
+    unsigned int hash;
+    int key_offset;
+    int key_len;
+    int count;
+} word_map_entry;
+
+//Hash table used to count the words of a rank during the map phase
+typedef struct word_map_t {
+    word_map_entry* entries;
+    size_t capacity;
+    size_t size;
+    char* arena;
+    size_t arena_len;
+    size_t arena_cap;
+} word_map;
+
+//FNV-1a hash of the word
+static unsigned int word_hash(const char* word, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) word[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//64 bit hash used by the sketches (FNV-1a followed by the splitmix64 finalizer)
+static unsigned long long word_hash64(const char* word, size_t len) {
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) word[i];
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebull;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+static void word_map_init(word_map* map) {
+    map->capacity = map_initial_capacity;
+    map->size = 0;
+    map->entries = (word_map_entry *) malloc(sizeof(word_map_entry) * map->capacity);
+    for (size_t i = 0; i < map->capacity; i++) {
+        map->entries[i].key_offset = -1;
+    }
+    map->arena_cap = arena_initial_size;
+    map->arena_len = 0;
+    map->arena = (char *) malloc(map->arena_cap);
+}
+
+static void word_map_free(word_map* map) {
+    free(map->entries);
+    free(map->arena);
+    map->entries = NULL;
+    map->arena = NULL;
+    map->capacity = 0;
+    map->size = 0;
+}
+
+//Double the number of slots and re-insert the entries, the arena is left untouched
+static void word_map_grow(word_map* map) {
+    size_t new_capacity = map->capacity * 2;
+    word_map_entry* new_entries = (word_map_entry *) malloc(sizeof(word_map_entry) * new_capacity);
+    for (size_t i = 0; i < new_capacity; i++) {
+        new_entries[i].key_offset = -1;
+    }
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->entries[i].key_offset >= 0) {
+            size_t slot = map->entries[i].hash & (new_capacity - 1);
+            while (new_entries[slot].key_offset >= 0) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            new_entries[slot] = map->entries[i];
+        }
+    }
+    free(map->entries);
+    map->entries = new_entries;
+    map->capacity = new_capacity;
+}
+
+//Copy the word (null terminated) at the end of the arena and return its offset
+static int word_map_store_key(word_map* map, const char* word, size_t len) {
+    if (map->arena_len + len + 1 > map->arena_cap) {
+        while (map->arena_len + len + 1 > map->arena_cap) {
+            map->arena_cap *= 2;
+        }
+        map->arena = (char *) realloc(map->arena, map->arena_cap);
+    }
+    int offset = (int) map->arena_len;
+    memcpy(&map->arena[offset], word, len);
+    map->arena[offset + len] = '\0';
+    map->arena_len += len + 1;
+    return offset;
+}
+
+//Add count occurrences of the word whose hash is already known
+static void word_map_add_hashed(word_map* map, const char* word, size_t len, unsigned int hash, int count) {
+    //Keep the load factor under 0.5 so that the probe sequences stay short
+    if ((map->size + 1) * 2 > map->capacity) {
+        word_map_grow(map);
+    }
+    size_t slot = hash & (map->capacity - 1);
+    while (map->entries[slot].key_offset >= 0) {
+        word_map_entry* entry = &map->entries[slot];
+        if (entry->hash == hash && entry->key_len == (int) len &&
+            memcmp(&map->arena[entry->key_offset], word, len) == 0) {
+            entry->count += count;
+            return;
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    map->entries[slot].hash = hash;
+    map->entries[slot].key_offset = word_map_store_key(map, word, len);
+    map->entries[slot].key_len = (int) len;
+    map->entries[slot].count = count;
+    map->size++;
+}
+
+//Add count occurrences of the word, inserting it if it is not in the map yet
+static void word_map_add(word_map* map, const char* word, size_t len, int count) {
+    word_map_add_hashed(map, word, len, word_hash(word, len), count);
+}
+
+//Add all the words of src to dst (the stored hashes are reused)
+static void word_map_merge(word_map* dst, const word_map* src) {
+    for (size_t i = 0; i < src->capacity; i++) {
+        const word_map_entry* entry = &src->entries[i];
+        if (entry->key_offset >= 0) {
+            word_map_add_hashed(dst, &src->arena[entry->key_offset], entry->key_len, entry->hash, entry->count);
+        }
+    }
+}
+
+//Rank that reduces the word: the high bits of the hash are used, so that the
+//low bits (used for the slots of the table) stay uniform inside each partition
+static int word_owner(unsigned int hash, int world_size) {
+    return (int) (((unsigned long long) hash * (unsigned int) world_size) >> 32);
+}
+
+//Word of the map as seen from outside (the pointer refers to the arena)
+typedef struct word_view_t {
+    const char* word;
+    int len;
+    int count;
+    int owner;
+} word_view;
+
+//Order of the words (the views are not necessarily null terminated)
+static int compare_words(const word_view* a, const word_view* b) {
+    int cmp = memcmp(a->word, b->word, a->len < b->len ? a->len : b->len);
+    return cmp != 0 ? cmp : a->len - b->len;
+}
+
+static int compare_views(const void* a, const void* b) {
+    return compare_words((const word_view *) a, (const word_view *) b);
+}
+
+//Order of the top-K output: higher counts first, ties broken by the word
+static int compare_top(const void* a, const void* b) {
+    const word_view* va = (const word_view *) a;
+    const word_view* vb = (const word_view *) b;
+    if (va->count != vb->count) {
+        return va->count > vb->count ? -1 : 1;
+    }
+    return compare_words(va, vb);
+}
+
+//Keep only the words that occur at least min_count times, return how many are left
+static int filter_views(word_view* views, int n, int min_count) {
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (views[i].count >= min_count) {
+            views[kept++] = views[i];
+        }
+    }
+    return kept;
+}
+
+//Move the k best words (compare_top order) at the beginning of views, sorted.
+//A bounded min-heap of k elements is used, so the cost is O(n log k).
+static int top_k_views(word_view* views, int n, int k) {
+    if (n <= k) {
+        qsort(views, n, sizeof(word_view), compare_top);
+        return n;
+    }
+    word_view* heap = (word_view *) malloc(sizeof(word_view) * k);
+    int size = 0;
+    for (int i = 0; i < n; i++) {
+        int pos;
+        if (size < k) {
+            //Sift up: the root is the worst of the candidates
+            pos = size++;
+            while (pos > 0 && compare_top(&views[i], &heap[(pos - 1) / 2]) > 0) {
+                heap[pos] = heap[(pos - 1) / 2];
+                pos = (pos - 1) / 2;
+            }
+            heap[pos] = views[i];
+        } else if (compare_top(&views[i], &heap[0]) < 0) {
+            //Replace the worst candidate and sift down
+            pos = 0;
+            while (2 * pos + 1 < size) {
+                int child = 2 * pos + 1;
+                if (child + 1 < size && compare_top(&heap[child + 1], &heap[child]) > 0) {
+                    child++;
+                }
+                if (compare_top(&heap[child], &views[i]) <= 0) {
+                    break;
+                }
+                heap[pos] = heap[child];
+                pos = child;
+            }
+            heap[pos] = views[i];
+        }
+    }
+    qsort(heap, size, sizeof(word_view), compare_top);
+    memcpy(views, heap, sizeof(word_view) * size);
+    free(heap);
+    return size;
+}
+
+//List the words of the map; the views are valid as long as the map is
+static word_view* word_map_views(const word_map* map, int world_size) {
+    word_view* views = (word_view *) malloc(sizeof(word_view) * (map->size > 0 ? map->size : 1));
+    int n = 0;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->entries[i].key_offset >= 0) {
+            views[n].word = &map->arena[map->entries[i].key_offset];
+            views[n].len = map->entries[i].key_len;
+            views[n].count = map->entries[i].count;
+            views[n].owner = word_owner(map->entries[i].hash, world_size);
+            n++;
+        }
+    }
+    return views;
+}
+
+//Append the views to the packed buffers; offsets are relative to segment_start,
+//the position in bytes where the segment sent to a single rank begins
+static void pack_views(const word_view* views, int n, int segment_start,
+                       word_header* headers, char* bytes, int* bytes_len) {
+    for (int i = 0; i < n; i++) {
+        headers[i].offset = *bytes_len - segment_start;
+        headers[i].count = views[i].count;
+        memcpy(&bytes[*bytes_len], views[i].word, views[i].len);
+        *bytes_len += views[i].len;
+    }
+}
+
+//Length of the j-th word of a segment of n words and segment_bytes bytes
+static int packed_len(const word_header* headers, int j, int n, int segment_bytes) {
+    return (j + 1 < n ? headers[j + 1].offset : segment_bytes) - headers[j].offset;
+}
+
+static int is_delimiter(char c) {
+    return c == '\n' || c == ' ';
+}
+
+//Tokenizer over an in-memory buffer: the tokens are returned as views of the
+//buffer, nothing is copied
+typedef struct tokenizer_t {
+    const char* data;
+    size_t len;
+    size_t pos;
+} tokenizer;
+
+//Position of the first delimiter (want_delimiter = 1) or of the first non delimiter
+//(want_delimiter = 0) at or after pos, len if there is none
+static size_t scan(const char* data, size_t pos, size_t len, int want_delimiter) {
+#if defined(__AVX2__)
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    while (pos + 32 <= len) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) &data[pos]);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_cmpeq_epi8(block, spaces), _mm256_cmpeq_epi8(block, newlines)));
+        if (!want_delimiter) {
+            mask = ~mask;
+        }
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    while (pos + 16 <= len) {
+        __m128i block = _mm_loadu_si128((const __m128i *) &data[pos]);
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(block, spaces), _mm_cmpeq_epi8(block, newlines)));
+        if (!want_delimiter) {
+            mask = ~mask & 0xFFFF;
+        }
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos < len && is_delimiter(data[pos]) != want_delimiter) {
+        pos++;
+    }
+    return pos;
+}
+
+//Return 1 and the next token, 0 when the buffer is over
+static int next_token(tokenizer* t, const char** word, size_t* len) {
+    size_t start = scan(t->data, t->pos, t->len, 0);
+    if (start == t->len) {
+        t->pos = start;
+        return 0;
+    }
+    size_t end = scan(t->data, start, t->len, 1);
+    *word = &t->data[start];
+    *len = end - start;
+    t->pos = end;
+    return 1;
+}
+
+//Count the words of an in-memory buffer, return the number of tokens found
+static long count_buffer(word_map* map, const char* buffer, size_t len) {
+    long tokens = 0;
+    tokenizer t = {buffer, len, 0};
+    const char* word;
+    size_t word_len;
+    while (next_token(&t, &word, &word_len)) {
+        word_map_add(map, word, word_len, 1);
+        tokens++;
+    }
+    return tokens;
+}
+
+//Work of a thread of the map phase: a slice of the buffer and the map it counts into
+typedef struct map_task_t {
+    const char* data;
+    size_t len;
+    word_map* map;
+    word_map* other;
+    long tokens;
+} map_task;
+
+static void* count_slice(void* arg) {
+    map_task* task = (map_task *) arg;
+    task->tokens = count_buffer(task->map, task->data, task->len);
+    return NULL;
+}
+
+static void* merge_maps(void* arg) {
+    map_task* task = (map_task *) arg;
+    word_map_merge(task->map, task->other);
+    word_map_free(task->other);
+    return NULL;
+}
+
+//Count the buffer with n_threads threads: the buffer is split on delimiters, every
+//thread counts its slice in its own map and the maps are then merged in a tree
+//(log2(n_threads) rounds of parallel pairwise merges) into map.
+//Only the calling thread uses MPI, as required by MPI_THREAD_FUNNELED.
+static long count_buffer_threads(word_map* map, const char* buffer, size_t len, int n_threads) {
+    if (n_threads <= 1) {
+        return count_buffer(map, buffer, len);
+    }
+    pthread_t* threads = (pthread_t *) malloc(sizeof(pthread_t) * n_threads);
+    map_task* tasks = (map_task *) malloc(sizeof(map_task) * n_threads);
+    word_map* maps = (word_map *) malloc(sizeof(word_map) * n_threads);
+    long tokens = 0;
+
+    size_t start = 0;
+    for (int t = 0; t < n_threads; t++) {
+        size_t end = t == n_threads - 1 ? len : len / n_threads * (t + 1);
+        if (end < start) {
+            end = start;
+        }
+        //Move the end of the slice after the word it cuts
+        end = scan(buffer, end, len, 1);
+        tasks[t].data = &buffer[start];
+        tasks[t].len = end - start;
+        tasks[t].map = t == 0 ? map : &maps[t];
+        if (t > 0) {
+            word_map_init(&maps[t]);
+        }
+        pthread_create(&threads[t], NULL, count_slice, &tasks[t]);
+        start = end;
+    }
+    for (int t = 0; t < n_threads; t++) {
+        pthread_join(threads[t], NULL);
+        tokens += tasks[t].tokens;
+    }
+
+    for (int stride = 1; stride < n_threads; stride *= 2) {
+        for (int t = 0; t + stride < n_threads; t += 2 * stride) {
+            tasks[t].other = tasks[t + stride].map;
+            pthread_create(&threads[t], NULL, merge_maps, &tasks[t]);
+        }
+        for (int t = 0; t + stride < n_threads; t += 2 * stride) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+
+    free(threads);
+    free(tasks);
+    free(maps);
+    return tokens;
+}
+
+//Sketches of the approximate mode: their size does not depend on the vocabulary
+//and they are merged element-wise (sum for the Count-Min Sketch, max for HyperLogLog)
+typedef struct word_sketch_t {
+    long long* cms;
+    unsigned char* hll;
+    long long tokens;
+} word_sketch;
+
+static void word_sketch_init(word_sketch* sketch) {
+    sketch->cms = (long long *) calloc((size_t) cms_depth * cms_width, sizeof(long long));
+    sketch->hll = (unsigned char *) calloc(1 << hll_precision, 1);
+    sketch->tokens = 0;
+}
+
+static void word_sketch_free(word_sketch* sketch) {
+    free(sketch->cms);
+    free(sketch->hll);
+}
+
+//Column of the word in the given row (double hashing on the two halves of the hash)
+static size_t cms_column(unsigned long long hash, int row) {
+    unsigned int h1 = (unsigned int) hash;
+    unsigned int h2 = (unsigned int) (hash >> 32) | 1u;
+    return (h1 + (unsigned int) row * h2) & (cms_width - 1);
+}
+
+static void word_sketch_add(word_sketch* sketch, const char* word, size_t len) {
+    unsigned long long hash = word_hash64(word, len);
+    for (int row = 0; row < cms_depth; row++) {
+        sketch->cms[(size_t) row * cms_width + cms_column(hash, row)]++;
+    }
+    //The first bits select the register, the rank of the first 1 in the others is stored
+    unsigned int reg = (unsigned int) (hash >> (64 - hll_precision));
+    unsigned long long rest = hash << hll_precision;
+    unsigned char rank = rest == 0 ? 64 - hll_precision + 1 : (unsigned char) (__builtin_clzll(rest) + 1);
+    if (rank > sketch->hll[reg]) {
+        sketch->hll[reg] = rank;
+    }
+    sketch->tokens++;
+}
+
+//Estimated count of the word: never lower than the real one
+static long long word_sketch_count(const word_sketch* sketch, const char* word, size_t len) {
+    unsigned long long hash = word_hash64(word, len);
+    long long estimate = LLONG_MAX;
+    for (int row = 0; row < cms_depth; row++) {
+        long long value = sketch->cms[(size_t) row * cms_width + cms_column(hash, row)];
+        if (value < estimate) {
+            estimate = value;
+        }
+    }
+    return estimate;
+}
+
+//Estimated number of distinct words (with the linear counting correction for small sets)
+static double word_sketch_distinct(const word_sketch* sketch) {
+    const int m = 1 << hll_precision;
+    double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < m; i++) {
+        sum += ldexp(1.0, -sketch->hll[i]);
+        if (sketch->hll[i] == 0) {
+            zeros++;
+        }
+    }
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log((double) m / zeros);
+    }
+    return estimate;
+}
+
+static long sketch_buffer(word_sketch* sketch, const char* buffer, size_t len) {
+    long tokens = 0;
+    tokenizer t = {buffer, len, 0};
+    const char* word;
+    size_t word_len;
+    while (next_token(&t, &word, &word_len)) {
+        word_sketch_add(sketch, word, word_len);
+        tokens++;
+    }
+    return tokens;
+}
+
+//Merge the sketches of all the ranks on rank 0 and print the estimates with their error bounds
+static void report_sketch(word_sketch* sketch, int my_rank, char** queries, int n_queries) {
+    word_sketch merged;
+    if (my_rank == 0) {
+        word_sketch_init(&merged);
+    }
+    MPI_Reduce(sketch->cms, my_rank == 0 ? merged.cms : NULL, cms_depth * cms_width, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(sketch->hll, my_rank == 0 ? merged.hll : NULL, 1 << hll_precision, MPI_UNSIGNED_CHAR, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&sketch->tokens, my_rank == 0 ? &merged.tokens : NULL, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (my_rank == 0) {
+        //HyperLogLog standard error: 1.04 / sqrt(m)
+        double distinct = word_sketch_distinct(&merged);
+        double relative_error = 1.04 / sqrt((double) (1 << hll_precision));
+        //Count-Min Sketch: overestimate at most e / width * tokens with probability 1 - e^-depth
+        double max_error = exp(1.0) / cms_width * merged.tokens;
+        double confidence = 1.0 - exp(-(double) cms_depth);
+
+        printf("Tokens: %lld\n", merged.tokens);
+        printf("Distinct words ~ %.0f (standard error %.2f%%, +/- %.0f)\n",
+               distinct, relative_error * 100, distinct * relative_error);
+        for (int q = 0; q < n_queries; q++) {
+            printf("%s ~ %lld (overestimated by at most %.0f with probability %.1f%%)\n",
+                   queries[q], word_sketch_count(&merged, queries[q], strlen(queries[q])),
+                   max_error, confidence * 100);
+        }
+        word_sketch_free(&merged);
+    }
+}
+
+//Out-of-core mode: when the hash table exceeds the memory budget its words are
+//written, sorted, to a run file and the table starts again empty. The runs are
+//merged with a k-way merge, so that memory stays bounded by the budget.
+//A record of a run is the length of the word, its count and the word itself.
+typedef struct spill_state_t {
+    size_t budget;
+    const char* dir;
+    int my_rank;
+    char** runs;
+    int n_runs;
+    int runs_cap;
+} spill_state;
+
+//Reader of a run file that keeps the current record in memory
+typedef struct run_reader_t {
+    FILE* file;
+    char* word;
+    int len;
+    int cap;
+    int count;
+    int has_record;
+} run_reader;
+
+//Sink of the records produced by a merge
+typedef void (*record_sink)(void* ctx, const char* word, int len, int count);
+
+static size_t word_map_bytes(const word_map* map) {
+    return map->capacity * sizeof(word_map_entry) + map->arena_cap;
+}
+
+static void write_record(FILE* file, const char* word, int len, int count) {
+    fwrite(&len, sizeof(int), 1, file);
+    fwrite(&count, sizeof(int), 1, file);
+    fwrite(word, 1, len, file);
+}
+
+static char* spill_path(const spill_state* spill, const char* kind, int n) {
+    char* path = (char *) malloc(strlen(spill->dir) + 64);
+    sprintf(path, "%s/word_count.%d.%d.%s%d", spill->dir, (int) getpid(), spill->my_rank, kind, n);
+    return path;
+}
+
+static FILE* open_spill_file(const char* path, const char* mode) {
+    FILE* file = fopen(path, mode);
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open the spill file %s\n", path);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return file;
+}
+
+//Write the words of the map, sorted, to a new run and empty the map
+static void spill_map(spill_state* spill, word_map* map) {
+    if (map->size == 0) {
+        return;
+    }
+    if (spill->n_runs == spill->runs_cap) {
+        spill->runs_cap = spill->runs_cap > 0 ? spill->runs_cap * 2 : 16;
+        spill->runs = (char **) realloc(spill->runs, sizeof(char *) * spill->runs_cap);
+    }
+    char* path = spill_path(spill, "run", spill->n_runs);
+    spill->runs[spill->n_runs++] = path;
+
+    word_view* views = word_map_views(map, 1);
+    qsort(views, map->size, sizeof(word_view), compare_views);
+    FILE* file = open_spill_file(path, "wb");
+    for (size_t i = 0; i < map->size; i++) {
+        write_record(file, views[i].word, views[i].len, views[i].count);
+    }
+    fclose(file);
+    free(views);
+    word_map_free(map);
+    word_map_init(map);
+}
+
+//Count the buffer spilling the map every time it grows over the budget
+static long count_buffer_spill(spill_state* spill, word_map* map, const char* buffer, size_t len) {
+    long tokens = 0;
+    tokenizer t = {buffer, len, 0};
+    const char* word;
+    size_t word_len;
+    while (next_token(&t, &word, &word_len)) {
+        word_map_add(map, word, word_len, 1);
+        tokens++;
+        if (word_map_bytes(map) > spill->budget) {
+            spill_map(spill, map);
+        }
+    }
+    return tokens;
+}
+
+static int run_reader_next(run_reader* reader) {
+    int header[2];
+    reader->has_record = fread(header, sizeof(int), 2, reader->file) == 2;
+    if (reader->has_record) {
+        if (header[0] > reader->cap) {
+            reader->cap = header[0] * 2;
+            reader->word = (char *) realloc(reader->word, reader->cap);
+        }
+        reader->len = header[0];
+        reader->count = header[1];
+        if (fread(reader->word, 1, reader->len, reader->file) != (size_t) reader->len) {
+            reader->has_record = 0;
+        }
+    }
+    return reader->has_record;
+}
+
+static void run_reader_open(run_reader* reader, const char* path) {
+    reader->file = open_spill_file(path, "rb");
+    reader->cap = word_initial_size;
+    reader->word = (char *) malloc(reader->cap);
+    run_reader_next(reader);
+}
+
+static void run_reader_close(run_reader* reader) {
+    fclose(reader->file);
+    free(reader->word);
+}
+
+static int compare_readers(const run_reader* a, const run_reader* b) {
+    word_view va = {a->word, a->len, 0, 0};
+    word_view vb = {b->word, b->len, 0, 0};
+    return compare_words(&va, &vb);
+}
+
+//Restore the heap property (smallest current word on top) from position pos
+static void reader_heap_down(run_reader** heap, int size, int pos) {
+    while (2 * pos + 1 < size) {
+        int child = 2 * pos + 1;
+        if (child + 1 < size && compare_readers(heap[child + 1], heap[child]) < 0) {
+            child++;
+        }
+        if (compare_readers(heap[pos], heap[child]) <= 0) {
+            break;
+        }
+        run_reader* tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+        pos = child;
+    }
+}
+
+//k-way merge of sorted runs: every word is passed once to the sink, in order,
+//with the sum of its counts. The run files are deleted.
+static void merge_runs(char** paths, int n, record_sink sink, void* ctx) {
+    run_reader* readers = (run_reader *) malloc(sizeof(run_reader) * (n > 0 ? n : 1));
+    run_reader** heap = (run_reader **) malloc(sizeof(run_reader *) * (n > 0 ? n : 1));
+    int size = 0;
+    for (int i = 0; i < n; i++) {
+        run_reader_open(&readers[i], paths[i]);
+        if (readers[i].has_record) {
+            heap[size++] = &readers[i];
+        }
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) {
+        reader_heap_down(heap, size, i);
+    }
+
+    int current_cap = word_initial_size;
+    char* current = (char *) malloc(current_cap);
+    while (size > 0) {
+        int len = heap[0]->len;
+        long long count = 0;
+        if (len > current_cap) {
+            current_cap = len * 2;
+            current = (char *) realloc(current, current_cap);
+        }
+        memcpy(current, heap[0]->word, len);
+        //Sum the counts of the same word coming from the different runs
+        while (size > 0 && heap[0]->len == len && memcmp(heap[0]->word, current, len) == 0) {
+            count += heap[0]->count;
+            if (!run_reader_next(heap[0])) {
+                heap[0] = heap[--size];
+            }
+            reader_heap_down(heap, size, 0);
+        }
+        sink(ctx, current, len, count > INT_MAX ? INT_MAX : (int) count);
+    }
+
+    for (int i = 0; i < n; i++) {
+        run_reader_close(&readers[i]);
+        remove(paths[i]);
+    }
+    free(current);
+    free(readers);
+    free(heap);
+}
+
+//Sink that splits the merged words among the files of their owners
+typedef struct partition_sink_t {
+    FILE** files;
+    int world_size;
+} partition_sink;
+
+static void write_to_owner(void* ctx, const char* word, int len, int count) {
+    partition_sink* partitions = (partition_sink *) ctx;
+    write_record(partitions->files[word_owner(word_hash(word, len), partitions->world_size)], word, len, count);
+}
+
+//Sink of the final merge: filter and then print or write to a file
+typedef struct output_sink_t {
+    FILE* file;
+    int min_count;
+    int print;
+    long words;
+} output_sink;
+
+static void write_output(void* ctx, const char* word, int len, int count) {
+    output_sink* output = (output_sink *) ctx;
+    if (count < output->min_count) {
+        return;
+    }
+    output->words++;
+    if (output->file != NULL) {
+        write_record(output->file, word, len, count);
+    } else if (output->print) {
+        printf("%.*s -> %d\n", len, word, count);
+    }
+}
+
+//Append records of the reader to the packed buffers until about limit bytes are used
+static int pack_records(run_reader* reader, size_t limit, word_header** headers, int* n_headers, int* headers_cap,
+                        char** bytes, int* n_bytes, int* bytes_cap, int segment_start) {
+    int packed = 0;
+    size_t used = 0;
+    while (reader->has_record && (packed == 0 || used + reader->len + sizeof(word_header) <= limit)) {
+        if (*n_headers == *headers_cap) {
+            *headers_cap *= 2;
+            *headers = (word_header *) realloc(*headers, sizeof(word_header) * *headers_cap);
+        }
+        while (*n_bytes + reader->len > *bytes_cap) {
+            *bytes_cap *= 2;
+            *bytes = (char *) realloc(*bytes, *bytes_cap);
+        }
+        (*headers)[*n_headers].offset = *n_bytes - segment_start;
+        (*headers)[*n_headers].count = reader->count;
+        memcpy(&(*bytes)[*n_bytes], reader->word, reader->len);
+        (*n_headers)++;
+        *n_bytes += reader->len;
+        used += reader->len + sizeof(word_header);
+        packed++;
+        run_reader_next(reader);
+    }
+    return packed;
+}
+
+//Reduce phase of the out-of-core mode:
+//1. the runs of the rank (and what is left in the map) are merged and split by owner
+//2. the partitions are exchanged with MPI_Alltoallv in rounds of bounded size and
+//   every rank appends what it receives to one sorted file per source
+//3. the files received are merged into the final counts of the partition
+//4. rank 0 receives the partitions of the other ranks in batches and prints them
+static void out_of_core_reduce(spill_state* spill, word_map* map, MPI_Datatype mpi_word_header,
+                               int world_size, int min_count, int gather_output, int benchmark,
+                               double map_time, double map_start, long total_tokens) {
+    int my_rank = spill->my_rank;
+    size_t batch = spill->budget / (2 * world_size);
+    if (batch < spill_min_batch) {
+        batch = spill_min_batch;
+    }
+    double reduce_start = MPI_Wtime();
+
+    //1. Local merge, split by owner
+    spill_map(spill, map);
+    int n_local_runs = spill->n_runs;
+    char** parts = (char **) malloc(sizeof(char *) * world_size);
+    char** received = (char **) malloc(sizeof(char *) * world_size);
+    FILE** files = (FILE **) malloc(sizeof(FILE *) * world_size);
+    for (int l = 0; l < world_size; l++) {
+        parts[l] = spill_path(spill, "part", l);
+        received[l] = spill_path(spill, "from", l);
+        files[l] = open_spill_file(parts[l], "wb");
+    }
+    partition_sink partitions = {files, world_size};
+    merge_runs(spill->runs, spill->n_runs, write_to_owner, &partitions);
+    for (int l = 0; l < world_size; l++) {
+        fclose(files[l]);
+    }
+
+    //2. Exchange in rounds
+    run_reader* readers = (run_reader *) malloc(sizeof(run_reader) * world_size);
+    for (int l = 0; l < world_size; l++) {
+        run_reader_open(&readers[l], parts[l]);
+        files[l] = open_spill_file(received[l], "wb");
+    }
+    int* send_counts = (int *) malloc(sizeof(int) * 2 * world_size);
+    int* recv_counts = (int *) malloc(sizeof(int) * 2 * world_size);
+    int* counts = (int *) malloc(sizeof(int) * 4 * world_size);
+    int* displs = (int *) malloc(sizeof(int) * 4 * world_size);
+    int headers_cap = 1024;
+    int bytes_cap = 64 * 1024;
+    word_header* headers = (word_header *) malloc(sizeof(word_header) * headers_cap);
+    char* bytes = (char *) malloc(bytes_cap);
+    word_header* recv_headers = NULL;
+    char* recv_bytes = NULL;
+    int rounds = 0;
+    int more = 1;
+    while (more) {
+        int n_headers = 0;
+        int n_bytes = 0;
+        int local_more = 0;
+        for (int l = 0; l < world_size; l++) {
+            int segment_start = n_bytes;
+            displs[l] = n_headers;
+            displs[world_size + l] = n_bytes;
+            send_counts[2 * l] = pack_records(&readers[l], batch, &headers, &n_headers, &headers_cap,
+                                              &bytes, &n_bytes, &bytes_cap, segment_start);
+            send_counts[2 * l + 1] = n_bytes - segment_start;
+            local_more |= readers[l].has_record;
+        }
+        MPI_Alltoall(send_counts, 2, MPI_INT, recv_counts, 2, MPI_INT, MPI_COMM_WORLD);
+
+        //counts/displs: words sent, bytes sent, words received, bytes received
+        int n_recv_headers = 0;
+        int n_recv_bytes = 0;
+        for (int l = 0; l < world_size; l++) {
+            counts[l] = send_counts[2 * l];
+            counts[world_size + l] = send_counts[2 * l + 1];
+            counts[2 * world_size + l] = recv_counts[2 * l];
+            counts[3 * world_size + l] = recv_counts[2 * l + 1];
+            displs[2 * world_size + l] = n_recv_headers;
+            displs[3 * world_size + l] = n_recv_bytes;
+            n_recv_headers += recv_counts[2 * l];
+            n_recv_bytes += recv_counts[2 * l + 1];
+        }
+        recv_headers = (word_header *) realloc(recv_headers, sizeof(word_header) * (n_recv_headers > 0 ? n_recv_headers : 1));
+        recv_bytes = (char *) realloc(recv_bytes, n_recv_bytes > 0 ? n_recv_bytes : 1);
+        MPI_Alltoallv(headers, counts, displs, mpi_word_header,
+                      recv_headers, &counts[2 * world_size], &displs[2 * world_size], mpi_word_header, MPI_COMM_WORLD);
+        MPI_Alltoallv(bytes, &counts[world_size], &displs[world_size], MPI_CHAR,
+                      recv_bytes, &counts[3 * world_size], &displs[3 * world_size], MPI_CHAR, MPI_COMM_WORLD);
+
+        //Every source sends its partition in order, so each received file stays sorted
+        for (int l = 0; l < world_size; l++) {
+            word_header* segment = &recv_headers[displs[2 * world_size + l]];
+            char* segment_bytes = &recv_bytes[displs[3 * world_size + l]];
+            int n = counts[2 * world_size + l];
+            for (int j = 0; j < n; j++) {
+                write_record(files[l], &segment_bytes[segment[j].offset],
+                             packed_len(segment, j, n, counts[3 * world_size + l]), segment[j].count);
+            }
+        }
+        rounds++;
+        MPI_Allreduce(&local_more, &more, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+    }
+    for (int l = 0; l < world_size; l++) {
+        run_reader_close(&readers[l]);
+        remove(parts[l]);
+        fclose(files[l]);
+    }
+    double shuffle_time = MPI_Wtime() - reduce_start;
+
+    //3. Final merge of the partition
+    double merge_start = MPI_Wtime();
+    char* final_path = spill_path(spill, "final", 0);
+    output_sink output = {NULL, min_count, !benchmark, 0};
+    if (gather_output && my_rank != 0) {
+        output.file = open_spill_file(final_path, "wb");
+    }
+    merge_runs(received, world_size, write_output, &output);
+    if (output.file != NULL) {
+        fclose(output.file);
+    }
+    double merge_time = MPI_Wtime() - merge_start;
+
+    if (benchmark) {
+        printf("Rank %d: %d runs spilled, %d exchange rounds, owns %ld words\n",
+               my_rank, n_local_runs, rounds, output.words);
+    }
+
+    //4. Streaming gather: rank 0 prints the partitions in rank order, batch by batch
+    double gather_start = MPI_Wtime();
+    if (gather_output) {
+        int batch_counts[2];
+        if (my_rank == 0) {
+            for (int l = 1; l < world_size; l++) {
+                while (1) {
+                    MPI_Recv(batch_counts, 2, MPI_INT, l, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    if (batch_counts[0] == 0) {
+                        break;
+                    }
+                    if (batch_counts[0] > headers_cap) {
+                        headers_cap = batch_counts[0];
+                        headers = (word_header *) realloc(headers, sizeof(word_header) * headers_cap);
+                    }
+                    if (batch_counts[1] > bytes_cap) {
+                        bytes_cap = batch_counts[1];
+                        bytes = (char *) realloc(bytes, bytes_cap);
+                    }
+                    MPI_Recv(headers, batch_counts[0], mpi_word_header, l, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    MPI_Recv(bytes, batch_counts[1], MPI_CHAR, l, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    if (!benchmark) {
+                        for (int j = 0; j < batch_counts[0]; j++) {
+                            printf("%.*s -> %d\n", packed_len(headers, j, batch_counts[0], batch_counts[1]),
+                                   &bytes[headers[j].offset], headers[j].count);
+                        }
+                    }
+                }
+            }
+        } else {
+            run_reader reader;
+            run_reader_open(&reader, final_path);
+            do {
+                batch_counts[0] = 0;
+                batch_counts[1] = 0;
+                pack_records(&reader, batch, &headers, &batch_counts[0], &headers_cap,
+                             &bytes, &batch_counts[1], &bytes_cap, 0);
+                MPI_Send(batch_counts, 2, MPI_INT, 0, 1, MPI_COMM_WORLD);
+                if (batch_counts[0] > 0) {
+                    MPI_Send(headers, batch_counts[0], mpi_word_header, 0, 2, MPI_COMM_WORLD);
+                    MPI_Send(bytes, batch_counts[1], MPI_CHAR, 0, 3, MPI_COMM_WORLD);
+                }
+            } while (batch_counts[0] > 0);
+            run_reader_close(&reader);
+            remove(final_path);
+        }
+    }
+    double gather_time = MPI_Wtime() - gather_start;
+
+    if (benchmark) {
+        double phases[5] = {map_time, shuffle_time, merge_time, gather_time, MPI_Wtime() - map_start};
+        double slowest[5];
+        MPI_Reduce(phases, slowest, 5, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (my_rank == 0) {
+            printf("Timings: ranks=%d tokens=%ld map=%.6f shuffle=%.6f merge=%.6f gather=%.6f total=%.6f\n",
+                   world_size, total_tokens, slowest[0], slowest[1], slowest[2], slowest[3], slowest[4]);
+        }
+    }
+
+    for (int i = 0; i < spill->n_runs; i++) {
+        free(spill->runs[i]);
+    }
+    free(spill->runs);
+    for (int l = 0; l < world_size; l++) {
+        free(parts[l]);
+        free(received[l]);
+    }
+    free(parts);
+    free(received);
+    free(final_path);
+    free(files);
+    free(readers);
+    free(send_counts);
+    free(recv_counts);
+    free(counts);
+    free(displs);
+    free(headers);
+    free(bytes);
+    free(recv_headers);
+    free(recv_bytes);
+}
+
+//Memory-map the file; if it cannot be mapped it is read in large blocks.
+//Return NULL if the file cannot be opened, *mapped tells how to release it.
+static char* load_file(const char* path, size_t* len, int* mapped) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    *len = 0;
+    *mapped = 0;
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            *len = st.st_size;
+            *mapped = 1;
+            return (char *) data;
+        }
+    }
+    size_t cap = read_block_size;
+    char* data = (char *) malloc(cap);
+    ssize_t n;
+    while ((n = read(fd, &data[*len], cap - *len)) > 0) {
+        *len += n;
+        if (*len == cap) {
+            cap *= 2;
+            data = (char *) realloc(data, cap);
+        }
+    }
+    close(fd);
+    return data;
+}
+
+static void unload_file(char* data, size_t len, int mapped) {
+    if (mapped) {
+        munmap(data, len);
+    } else {
+        free(data);
+    }
+}
+
+//What the other ranks need to know about a chunk to repair the words cut by the boundaries
+typedef struct chunk_info_t {
+    long long len;
+    long long lead_len;
+    long long has_delim;
+    long long ends_delim;
+} chunk_info;
+
+//The leading fragment of rank s continues a word started on a previous rank when
+//the closest non empty chunk before it does not end with a delimiter
+static int chunk_continues(const chunk_info* info, int s) {
+    if (info[s].len == 0 || info[s].lead_len == 0) {
+        return 0;
+    }
+    for (int q = s - 1; q >= 0; q--) {
+        if (info[q].len > 0) {
+            return !info[q].ends_delim;
+        }
+    }
+    return 0;
+}
+
+//Rank on which the word continued by the leading fragment of rank s starts
+static int chunk_owner(const chunk_info* info, int s) {
+    for (int q = s - 1; q >= 0; q--) {
+        if (info[q].len > 0 && (info[q].has_delim || !chunk_continues(info, q))) {
+            return q;
+        }
+    }
+    return 0;
+}
+
+//Read an equal byte range of path on every rank with MPI-IO. The fragments of the
+//words cut by the chunk boundaries are sent to the rank where the word starts, which
+//appends them to its last word. *begin is where the words of this rank start.
+static char* read_chunk_mpiio(const char* path, int my_rank, int world_size,
+                              size_t* len, size_t* begin) {
+    MPI_File fh;
+    MPI_Offset file_size;
+    if (MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (my_rank == 0) {
+            fprintf(stderr, "Cannot open %s\n", path);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_get_size(fh, &file_size);
+
+    MPI_Offset chunk = (file_size + world_size - 1) / world_size;
+    MPI_Offset offset = chunk * my_rank;
+    MPI_Offset my_len = offset < file_size ? (file_size - offset < chunk ? file_size - offset : chunk) : 0;
+
+    char* buffer = (char *) malloc(my_len > 0 ? my_len : 1);
+    //Collective reads must be called the same number of times on every rank
+    MPI_Offset pieces = (chunk + mpiio_piece_size - 1) / mpiio_piece_size;
+    for (MPI_Offset p = 0; p < pieces; p++) {
+        MPI_Offset done = p * mpiio_piece_size;
+        int piece = done < my_len ? (int) (my_len - done < mpiio_piece_size ? my_len - done : mpiio_piece_size) : 0;
+        MPI_File_read_at_all(fh, offset + done, &buffer[done < my_len ? done : 0], piece, MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&fh);
+
+    chunk_info mine;
+    mine.len = my_len;
+    mine.lead_len = 0;
+    while (mine.lead_len < my_len && !is_delimiter(buffer[mine.lead_len])) {
+        mine.lead_len++;
+    }
+    mine.has_delim = mine.lead_len < my_len;
+    mine.ends_delim = my_len > 0 && is_delimiter(buffer[my_len - 1]);
+
+    chunk_info* info = (chunk_info *) malloc(sizeof(chunk_info) * world_size);
+    MPI_Allgather(&mine, 4, MPI_LONG_LONG, info, 4, MPI_LONG_LONG, MPI_COMM_WORLD);
+
+    //Send the leading fragment to the owner of the word it belongs to
+    MPI_Request request = MPI_REQUEST_NULL;
+    *begin = 0;
+    if (chunk_continues(info, my_rank)) {
+        MPI_Isend(buffer, (int) mine.lead_len, MPI_CHAR, chunk_owner(info, my_rank), 0, MPI_COMM_WORLD, &request);
+        *begin = mine.lead_len;
+    }
+
+    //Receive, in order, the fragments that complete the last word of this rank
+    size_t total = my_len;
+    for (int s = my_rank + 1; s < world_size; s++) {
+        if (info[s].len == 0) {
+            continue;
+        }
+        if (!chunk_continues(info, s) || chunk_owner(info, s) != my_rank) {
+            break;
+        }
+        total += info[s].lead_len;
+    }
+    char* repaired = (char *) malloc(total > 0 ? total : 1);
+    memcpy(repaired, buffer, my_len);
+    size_t filled = my_len;
+    for (int s = my_rank + 1; s < world_size && filled < total; s++) {
+        if (info[s].len == 0) {
+            continue;
+        }
+        MPI_Recv(&repaired[filled], (int) info[s].lead_len, MPI_CHAR, s, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        filled += info[s].lead_len;
+    }
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+
+    free(buffer);
+    free(info);
+    *len = total;
+    return repaired;
+}
 
 int main(int argc, char** argv) {
     int actualSize = 0;
     const char *files_path = "../files/in";
-    int wordFound = 0;
-    int first = 1;
-    int endedWithNewLine = 0;
+    const char *single_file = NULL;
+    int benchmark = 0;
+    int gather_output = 1;
+    long tokens = 0;
+    int n_threads = 1;
+    int top_k = 0;
+    int min_count = 1;
+    int approximate = 0;
+    char** queries = (char **) malloc(sizeof(char *) * argc);
+    int n_queries = 0;
+    double memory_budget = 0;
+    const char *spill_dir = "/tmp";
 
-    MPI_Init(NULL, NULL);
+    //--bench prints the throughput of the map phase of every rank
+    //--no-gather lets every rank print its own partition instead of gathering the result on rank 0
+    //--input <prefix> reads the files <prefix><rank> instead of ../files/in<rank>
+    //--mpiio <path> splits a single file among all the ranks with MPI-IO
+    //--top <k> prints only the k most frequent words (it implies the final gather)
+    //--min-count <n> drops the words that occur less than n times before the final gather
+    //--approx counts with a Count-Min Sketch and a HyperLogLog instead of the exact shuffle
+    //--query <word> prints the approximate count of the word (can be repeated)
+    //--memory-budget <MB> spills sorted runs to disk when the hash table grows over the budget
+    //--spill-dir <dir> is where the runs are written (default /tmp)
+    //--threads <n> counts the input of the rank with n threads (MPI_THREAD_FUNNELED)
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--bench") == 0) {
+            benchmark = 1;
+        } else if (strcmp(argv[a], "--input") == 0 && a + 1 < argc) {
+            files_path = argv[++a];
+        } else if (strcmp(argv[a], "--mpiio") == 0 && a + 1 < argc) {
+            single_file = argv[++a];
+        } else if (strcmp(argv[a], "--no-gather") == 0) {
+            gather_output = 0;
+        } else if (strcmp(argv[a], "--approx") == 0) {
+            approximate = 1;
+        } else if (strcmp(argv[a], "--query") == 0 && a + 1 < argc) {
+            queries[n_queries++] = argv[++a];
+        } else if (strcmp(argv[a], "--top") == 0 && a + 1 < argc) {
+            top_k = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--min-count") == 0 && a + 1 < argc) {
+            min_count = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--memory-budget") == 0 && a + 1 < argc) {
+            memory_budget = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--spill-dir") == 0 && a + 1 < argc) {
+            spill_dir = argv[++a];
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            n_threads = atoi(argv[++a]);
+        }
+    }
 
-    // Create the char_int_pair MPI datatype
-    char_int_pair pair;
-    MPI_Datatype mpi_char_int_pair;
+    if (n_threads > 1) {
+        int provided;
+        MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+        if (provided < MPI_THREAD_FUNNELED) {
+            fprintf(stderr, "MPI_THREAD_FUNNELED not supported, using a single thread\n");
+            n_threads = 1;
+        }
+    } else {
+        n_threads = 1;
+        MPI_Init(&argc, &argv);
+    }
+
+    // Create the word_header MPI datatype
+    word_header header;
+    MPI_Datatype mpi_word_header;
     int struct_len = 2;
     int block_lens[struct_len];
     MPI_Datatype types[struct_len];
     // We need to compute the displacement to be really portable
     // (different compilers might align structures differently)
     MPI_Aint displacements[struct_len];
-    MPI_Aint current_displacement = 0;
-    //Add string
-    block_lens[0] = max_size;
-    types[0] = MPI_CHAR;
-    displacements[0] = (size_t) &(pair.c) - (size_t) &pair;
+    //Add the offset
+    block_lens[0] = 1;
+    types[0] = MPI_INT;
+    displacements[0] = (size_t) &(header.offset) - (size_t) &header;
     //Add the count
     block_lens[1] = 1;
     types[1] = MPI_INT;
-    displacements[1] = (size_t) &(pair.count) - (size_t) &pair;
+    displacements[1] = (size_t) &(header.count) - (size_t) &header;
     //Create and commit the data structure
-    MPI_Type_create_struct(struct_len, block_lens, displacements, types, &mpi_char_int_pair);
-    MPI_Type_commit(&mpi_char_int_pair);
+    MPI_Type_create_struct(struct_len, block_lens, displacements, types, &mpi_word_header);
+    MPI_Type_commit(&mpi_word_header);
 
     int my_rank, world_size;
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
@@ -48,207 +1262,305 @@ int main(int argc, char** argv) {
 
 
 
-    int files_path_len;
-    char my_file[files_path_len + 2];
-    files_path_len = strlen(files_path);
-    strcpy(my_file, files_path);
-    sprintf(&my_file[files_path_len], "%d", my_rank);
+    word_map local_map;
+    word_map_init(&local_map);
+    word_sketch sketch;
+    if (approximate) {
+        word_sketch_init(&sketch);
+    }
+    spill_state spill = {(size_t) (memory_budget * 1024 * 1024), spill_dir, my_rank, NULL, 0, 0};
+    double map_start;
 
-    char_int_pair* local_count;
+    if (single_file != NULL) {
+        size_t chunk_len, chunk_begin;
+        map_start = MPI_Wtime();
+        char* chunk = read_chunk_mpiio(single_file, my_rank, world_size, &chunk_len, &chunk_begin);
+        if (approximate) {
+            tokens = sketch_buffer(&sketch, &chunk[chunk_begin], chunk_len - chunk_begin);
+        } else if (spill.budget > 0) {
+            tokens = count_buffer_spill(&spill, &local_map, &chunk[chunk_begin], chunk_len - chunk_begin);
+        } else {
+            tokens = count_buffer_threads(&local_map, &chunk[chunk_begin], chunk_len - chunk_begin, n_threads);
+        }
+        free(chunk);
+    } else {
+        int files_path_len = strlen(files_path);
+        char my_file[files_path_len + 12];
+        strcpy(my_file, files_path);
+        sprintf(&my_file[files_path_len], "%d", my_rank);
 
-    FILE *file = fopen(my_file, "r");
-    char c;
-    char word[max_size];
-    int k = 0;
-    size_t len;
-    int r = 0;
-    char* lineChar;
-    char test;
-    while ((c = fgetc(file)) != EOF) {
-        //Get the word
-        if (c != '\n' && c != ' '){
-            word[k] = c;
-            k++;
-            endedWithNewLine = 0;
-        }
-        //Assign the word if we find newLine or space
-        if (c == '\n' || c == ' '){
-            //Assign word and clear it
-            //Cycle below doesn't solve the problem for \n
-            while(word[r] != '\0') {
-                if(word[r] == '\n' || word[r] == ' ')
-                {
-                    word[r] = '\0';
-                    break;
-                }
-                r++;
-            }
-            r = 0;
-            if (first == 1) {
-                first = 0;
-                actualSize++;
-                local_count = (char_int_pair *) malloc(sizeof(char_int_pair) * actualSize);
-
-                len = strlen(word);
-                memcpy(local_count[0].c, word, len);
-                local_count[0].c[len] = '\0';
-
-                local_count[0].count = 1;
-                wordFound = 1;
-            }
-            if (wordFound == 0) {
-                for (int i = 0; i < actualSize; i++) {
-                    if (strcmp(local_count[i].c, word) == 0) {
-                        local_count[i].count++;
-                        wordFound = 1;
-                        //break;
-                    }
-                }
-            }
-            if (wordFound == 0) {
-                actualSize++;
-                local_count = (char_int_pair *) realloc(local_count, sizeof(char_int_pair) * actualSize);
+        size_t file_len;
+        int mapped;
+        map_start = MPI_Wtime();
+        char* data = load_file(my_file, &file_len, &mapped);
+        if (data == NULL) {
+            fprintf(stderr, "Rank %d: cannot open %s\n", my_rank, my_file);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (approximate) {
+            tokens = sketch_buffer(&sketch, data, file_len);
+        } else if (spill.budget > 0) {
+            tokens = count_buffer_spill(&spill, &local_map, data, file_len);
+        } else {
+            tokens = count_buffer_threads(&local_map, data, file_len, n_threads);
+        }
+        unload_file(data, file_len, mapped);
+    }
+    double map_time = MPI_Wtime() - map_start;
+    long total_tokens = 0;
+    MPI_Reduce(&tokens, &total_tokens, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 
-                len = strlen(word);
-                memcpy(local_count[actualSize - 1].c, word, len);
-                local_count[actualSize - 1].c[len] = '\0';
+    if (benchmark) {
+        printf("Rank %d: %ld tokens, %zu distinct, map phase with %d thread(s) %.6f s (%.0f tokens/sec)\n",
+               my_rank, tokens, local_map.size, n_threads, map_time, map_time > 0 ? tokens / map_time : 0.0);
+    }
 
-                local_count[actualSize - 1].count = 1;
-            }
-            memset(word, 0, sizeof(word));
-            wordFound = 0;
-            k = 0;
-            endedWithNewLine = 1;
-        }
-    }
-
-    //Assign the word if we reach the EOF
-    if (endedWithNewLine == 0) {
-        //Cycle below doesn't solve the problem for \n
-        while(word[r] != '\0')
-        {
-            if(word[r] == '\n' || word[r] == ' ')
-            {
-                word[r]='\0';
-                break;
-            }
-            r++;
-        }
-        r = 0;
-        if (first == 1) {
-            first = 0;
-            //It could be good just this
-            actualSize++;
-            local_count = (char_int_pair *) malloc(sizeof(char_int_pair) * actualSize);
-
-            len = strlen(word);
-            memcpy(local_count[0].c, word, len);
-            local_count[0].c[len] = '\0';
-
-            local_count[0].count = 1;
-            wordFound = 1;
-        }
-        if (wordFound == 0) {
-            for (int i = 0; i < actualSize; i++) {
-                if (strcmp(local_count[i].c, word) == 0) {
-                    local_count[i].count++;
-                    wordFound = 1;
-                }
-            }
-        }
-        if (wordFound == 0) {
-            actualSize++;
-            local_count = (char_int_pair *) realloc(local_count, sizeof(char_int_pair) * actualSize);
+    if (approximate) {
+        //Constant communication: the sketches are reduced element-wise, no word is shipped
+        report_sketch(&sketch, my_rank, queries, n_queries);
+        fflush(stdout);
+        word_sketch_free(&sketch);
+        word_map_free(&local_map);
+        free(queries);
+        MPI_Type_free(&mpi_word_header);
+        MPI_Finalize();
+        return 0;
+    }
 
-            len = strlen(word);
-            memcpy(local_count[actualSize - 1].c, word, len);
-            local_count[actualSize - 1].c[len] = '\0';
+    if (spill.budget > 0) {
+        out_of_core_reduce(&spill, &local_map, mpi_word_header, world_size, min_count, gather_output,
+                           benchmark, map_time, map_start, total_tokens);
+        fflush(stdout);
+        word_map_free(&local_map);
+        free(queries);
+        MPI_Type_free(&mpi_word_header);
+        MPI_Finalize();
+        return 0;
+    }
 
-            local_count[actualSize - 1].count = 1;
-        }
-        memset(word, 0, sizeof(word));
+    //Shuffle: every word is sent to the rank that owns its hash, so that each rank
+    //reduces only its own partition of the vocabulary
+    double reduce_start = MPI_Wtime();
+    //Per destination: number of words and number of bytes
+    int* send_counts = (int *) calloc(2 * world_size, sizeof(int));
+    int* recv_counts = (int *) malloc(sizeof(int) * 2 * world_size);
+    int* word_counts = (int *) malloc(sizeof(int) * world_size);
+    int* byte_counts = (int *) malloc(sizeof(int) * world_size);
+    int* word_displs = (int *) malloc(sizeof(int) * world_size);
+    int* byte_displs = (int *) malloc(sizeof(int) * world_size);
+
+    int n_words = (int) local_map.size;
+    word_view* views = word_map_views(&local_map, world_size);
+    for (int i = 0; i < n_words; i++) {
+        send_counts[2 * views[i].owner]++;
+        send_counts[2 * views[i].owner + 1] += views[i].len;
     }
-    fclose(file);
 
+    //Group the words by owner
+    word_view* grouped = (word_view *) malloc(sizeof(word_view) * (n_words > 0 ? n_words : 1));
+    int send_words = 0;
+    int send_bytes = 0;
+    for (int l = 0; l < world_size; l++) {
+        word_counts[l] = send_counts[2 * l];
+        byte_counts[l] = send_counts[2 * l + 1];
+        word_displs[l] = send_words;
+        byte_displs[l] = send_bytes;
+        send_words += word_counts[l];
+        send_bytes += byte_counts[l];
+    }
+    int* position = (int *) malloc(sizeof(int) * world_size);
+    memcpy(position, word_displs, sizeof(int) * world_size);
+    for (int i = 0; i < n_words; i++) {
+        grouped[position[views[i].owner]++] = views[i];
+    }
+    free(position);
+    free(views);
 
-    //Here I gather the sizes
-    int* gather_length = NULL;
-    int sum = 0;
-    int max_value = 0;
+    word_header* send_headers = (word_header *) malloc(sizeof(word_header) * (send_words > 0 ? send_words : 1));
+    char* send_buffer = (char *) malloc(send_bytes > 0 ? send_bytes : 1);
+    int packed = 0;
+    for (int l = 0; l < world_size; l++) {
+        pack_views(&grouped[word_displs[l]], word_counts[l], byte_displs[l],
+                   &send_headers[word_displs[l]], send_buffer, &packed);
+    }
+    free(grouped);
+    word_map_free(&local_map);
 
-    gather_length = (int *) malloc(sizeof(int) * world_size);
+    MPI_Alltoall(send_counts, 2, MPI_INT, recv_counts, 2, MPI_INT, MPI_COMM_WORLD);
 
-    const int size[] = {1,1,1,1};
-    const int displacementSize[] = {0,1,2,3};
-    int gatherDisplacement[world_size];
+    int* recv_word_counts = (int *) malloc(sizeof(int) * world_size);
+    int* recv_byte_counts = (int *) malloc(sizeof(int) * world_size);
+    int* recv_word_displs = (int *) malloc(sizeof(int) * world_size);
+    int* recv_byte_displs = (int *) malloc(sizeof(int) * world_size);
+    int received = 0;
+    int received_bytes = 0;
+    for (int l = 0; l < world_size; l++) {
+        recv_word_counts[l] = recv_counts[2 * l];
+        recv_byte_counts[l] = recv_counts[2 * l + 1];
+        recv_word_displs[l] = received;
+        recv_byte_displs[l] = received_bytes;
+        received += recv_word_counts[l];
+        received_bytes += recv_byte_counts[l];
+    }
+    word_header* recv_headers = (word_header *) malloc(sizeof(word_header) * (received > 0 ? received : 1));
+    char* recv_buffer = (char *) malloc(received_bytes > 0 ? received_bytes : 1);
 
-    MPI_Gatherv(&actualSize, 1, MPI_INT, gather_length, size, displacementSize, MPI_INT, 0, MPI_COMM_WORLD);
+    //The two buffers of the packed format: the headers and the text
+    MPI_Alltoallv(send_headers, word_counts, word_displs, mpi_word_header,
+                  recv_headers, recv_word_counts, recv_word_displs, mpi_word_header, MPI_COMM_WORLD);
+    MPI_Alltoallv(send_buffer, byte_counts, byte_displs, MPI_CHAR,
+                  recv_buffer, recv_byte_counts, recv_byte_displs, MPI_CHAR, MPI_COMM_WORLD);
+    double shuffle_time = MPI_Wtime() - reduce_start;
 
-    if (my_rank == 0) {
-        gatherDisplacement[0] = 0;
-        for (int l = 1; l < world_size; l++){
-            if (max_value < gather_length[l]) {
-                max_value = gather_length[l];
-            }
-            gatherDisplacement[l] = sum + actualSize;
-            sum += gather_length[l];
+    //Reduce the partition owned by this rank
+    word_map partition;
+    word_map_init(&partition);
+    for (int l = 0; l < world_size; l++) {
+        word_header* segment = &recv_headers[recv_word_displs[l]];
+        char* segment_bytes = &recv_buffer[recv_byte_displs[l]];
+        for (int j = 0; j < recv_word_counts[l]; j++) {
+            word_map_add(&partition, &segment_bytes[segment[j].offset],
+                         packed_len(segment, j, recv_word_counts[l], recv_byte_counts[l]), segment[j].count);
         }
-        sum += actualSize;
     }
+    free(send_headers);
+    free(send_buffer);
+    free(recv_headers);
+    free(recv_buffer);
 
+    actualSize = (int) partition.size;
+    word_view* local_count = word_map_views(&partition, world_size);
+    //The owner has the global count of its words, so the filters are exact here
+    //and only the surviving words leave the rank
+    actualSize = filter_views(local_count, actualSize, min_count);
+    if (top_k > 0) {
+        //Candidates of this rank: every word of the global top-K is in the top-K of its owner
+        actualSize = top_k_views(local_count, actualSize, top_k);
+        gather_output = 1;
+    } else {
+        qsort(local_count, actualSize, sizeof(word_view), compare_views);
+    }
+    double reduce_time = MPI_Wtime() - reduce_start;
 
-    int found = 0;
-    char_int_pair* gather_buffer = NULL;
-
-    //Gather, collecting the different words and create the structure
-    if (my_rank == 0) {
-        gather_buffer = (char_int_pair *) realloc(gather_buffer, sizeof(char_int_pair) * sum);
+    if (benchmark) {
+        //Bytes moved by the shuffle: one header per word plus the text itself
+        long header_bytes = (long) send_words * (long) sizeof(word_header);
+        printf("Rank %d: received %d words, owns %zu words (%d kept), reduce phase %.6f s\n",
+               my_rank, received, partition.size, actualSize, reduce_time);
+        printf("Rank %d: shuffle sent %d words in %ld bytes (%ld header + %d text, %.2f bytes/word)\n",
+               my_rank, send_words, header_bytes + send_bytes, header_bytes, send_bytes,
+               send_words > 0 ? (double) (header_bytes + send_bytes) / send_words : 0.0);
     }
 
-    MPI_Gatherv(local_count, actualSize, mpi_char_int_pair, gather_buffer, gather_length, gatherDisplacement, mpi_char_int_pair, 0, MPI_COMM_WORLD);
+    double gather_start = MPI_Wtime();
+    if (gather_output) {
+        //Ordered gather: rank 0 collects the partitions in rank order and prints them
+        int gather_counts[2];
+        int sum = 0;
+        int sum_bytes = 0;
+        word_header* gather_headers = NULL;
+        char* gather_buffer = NULL;
 
-    if (my_rank == 0) {
-        int fixed_size = actualSize;
-        //To skip all the elements of the with rank 0
-        for (int j = fixed_size; j < sum; j++){
-            for (int i = 0; i < actualSize; i++) {
-                len = strlen(gather_buffer[j].c);
-                memcpy(word, gather_buffer[j].c, len);
-                word[len] = '\0';
-
-                if (strcmp(local_count[i].c, word) == 0) {
-                    local_count[i].count += gather_buffer[j].count;
-                    found = 1;
-                    break;
-                }
+        word_header* out_headers = (word_header *) malloc(sizeof(word_header) * (actualSize > 0 ? actualSize : 1));
+        int out_bytes = 0;
+        for (int i = 0; i < actualSize; i++) {
+            out_bytes += local_count[i].len;
+        }
+        char* out_buffer = (char *) malloc(out_bytes > 0 ? out_bytes : 1);
+        out_bytes = 0;
+        pack_views(local_count, actualSize, 0, out_headers, out_buffer, &out_bytes);
+
+        gather_counts[0] = actualSize;
+        gather_counts[1] = out_bytes;
+        MPI_Gather(gather_counts, 2, MPI_INT, recv_counts, 2, MPI_INT, 0, MPI_COMM_WORLD);
+        if (my_rank == 0) {
+            for (int l = 0; l < world_size; l++) {
+                recv_word_counts[l] = recv_counts[2 * l];
+                recv_byte_counts[l] = recv_counts[2 * l + 1];
+                recv_word_displs[l] = sum;
+                recv_byte_displs[l] = sum_bytes;
+                sum += recv_word_counts[l];
+                sum_bytes += recv_byte_counts[l];
             }
-            if (found == 0) {
-                actualSize++;
-                local_count = (char_int_pair *) realloc(local_count, sizeof(char_int_pair) * actualSize);
+            gather_headers = (word_header *) malloc(sizeof(word_header) * (sum > 0 ? sum : 1));
+            gather_buffer = (char *) malloc(sum_bytes > 0 ? sum_bytes : 1);
+        }
 
-                len = strlen(word);
-                memcpy(local_count[actualSize - 1].c, word, len);
-                local_count[actualSize - 1].c[len] = '\0';
+        MPI_Gatherv(out_headers, actualSize, mpi_word_header, gather_headers, recv_word_counts, recv_word_displs, mpi_word_header, 0, MPI_COMM_WORLD);
+        MPI_Gatherv(out_buffer, out_bytes, MPI_CHAR, gather_buffer, recv_byte_counts, recv_byte_displs, MPI_CHAR, 0, MPI_COMM_WORLD);
 
-                local_count[actualSize - 1].count += gather_buffer[j].count;
+        if (my_rank == 0) {
+            if (benchmark) {
+                long header_bytes = (long) sum * (long) sizeof(word_header);
+                printf("Rank 0: final gather received %d words in %ld bytes (%ld header + %d text)\n",
+                       sum, header_bytes + sum_bytes, header_bytes, sum_bytes);
+            } else if (top_k > 0) {
+                //Merge the candidates of all the ranks into the global top-K
+                word_view* candidates = (word_view *) malloc(sizeof(word_view) * (sum > 0 ? sum : 1));
+                for (int l = 0; l < world_size; l++) {
+                    word_header* segment = &gather_headers[recv_word_displs[l]];
+                    for (int j = 0; j < recv_word_counts[l]; j++) {
+                        word_view* candidate = &candidates[recv_word_displs[l] + j];
+                        candidate->word = &gather_buffer[recv_byte_displs[l] + segment[j].offset];
+                        candidate->len = packed_len(segment, j, recv_word_counts[l], recv_byte_counts[l]);
+                        candidate->count = segment[j].count;
+                        candidate->owner = l;
+                    }
+                }
+                int n_top = top_k_views(candidates, sum, top_k);
+                for (int i = 0; i < n_top; i++) {
+                    printf("%.*s -> %d\n", candidates[i].len, candidates[i].word, candidates[i].count);
+                }
+                free(candidates);
+            } else {
+                for (int l = 0; l < world_size; l++) {
+                    word_header* segment = &gather_headers[recv_word_displs[l]];
+                    char* segment_bytes = &gather_buffer[recv_byte_displs[l]];
+                    for (int j = 0; j < recv_word_counts[l]; j++) {
+                        printf("%.*s -> %d\n", packed_len(segment, j, recv_word_counts[l], recv_byte_counts[l]),
+                               &segment_bytes[segment[j].offset], segment[j].count);
+                    }
+                }
             }
-            memset(word, 0, sizeof(word));
-            found = 0;
+        }
+        free(out_headers);
+        free(out_buffer);
+        free(gather_headers);
+        free(gather_buffer);
+    } else if (!benchmark) {
+        //Every rank prints its own partition
+        for (int i = 0; i < actualSize; i++) {
+            printf("%s -> %d\n", local_count[i].word, local_count[i].count);
         }
     }
+    double gather_time = MPI_Wtime() - gather_start;
 
-    if (my_rank == 0) {
-        for (int i = 0; i < actualSize; i++) {
-            printf("%s -> %d\n", local_count[i].c, local_count[i].count);
-            //Usando la printf sotto, sembra che il \n faccia baggare la count e non la stringa (tipo una buffer overflow nella struct dove sembra si inserisca il \n nell'elemento sotto della struct)
+    if (benchmark) {
+        //Slowest rank of every phase, in a single line that the scaling harness can parse
+        double phases[5] = {map_time, shuffle_time, reduce_time - shuffle_time, gather_time, MPI_Wtime() - map_start};
+        double slowest[5];
+        MPI_Reduce(phases, slowest, 5, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (my_rank == 0) {
+            printf("Timings: ranks=%d tokens=%ld map=%.6f shuffle=%.6f merge=%.6f gather=%.6f total=%.6f\n",
+                   world_size, total_tokens, slowest[0], slowest[1], slowest[2], slowest[3], slowest[4]);
         }
     }
 
     fflush(stdout);
 
-    free(gather_length);
-    free(gather_buffer);
+    free(send_counts);
+    free(recv_counts);
+    free(word_counts);
+    free(byte_counts);
+    free(word_displs);
+    free(byte_displs);
+    free(recv_word_counts);
+    free(recv_byte_counts);
+    free(recv_word_displs);
+    free(recv_byte_displs);
     free(local_count);
-    MPI_Type_free(&mpi_char_int_pair);
+    word_map_free(&partition);
+    free(queries);
+    MPI_Type_free(&mpi_word_header);
     MPI_Finalize();
 }
@@ -0,0 +1,139 @@
+//Microbenchmark of the aggregation kernels: a column of random temperatures with a
+//random mask and sorted group ids (runs of random length) is aggregated several times
+//with the kernels of src/aggregate_kernels.cpp and with plain loops, checking that
+//count, min and max are the same and the sums agree to the last bits.
+#include "../src/aggregate_kernels.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Reference: the loops the kernels replace
+static column_stats scalar_stats(const float* values, const uint8_t* mask, size_t n) {
+    column_stats stats = {0, 0, INFINITY, -INFINITY};
+    for (size_t i = 0; i < n; i++) {
+        if (mask == NULL || mask[i] != 0) {
+            stats.sum += (double) values[i];
+            stats.count++;
+            if (values[i] < stats.min) {
+                stats.min = values[i];
+            }
+            if (values[i] > stats.max) {
+                stats.max = values[i];
+            }
+        }
+    }
+    return stats;
+}
+
+static void scalar_segmented(const float* values, const uint8_t* mask, const uint32_t* groups, size_t n,
+                             std::vector<group_stats>& out) {
+    out.clear();
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || groups[i] != groups[i - 1]) {
+            out.push_back(group_stats{groups[i], i, {0, 0, INFINITY, -INFINITY}});
+        }
+        column_stats& stats = out.back().stats;
+        if (mask == NULL || mask[i] != 0) {
+            stats.sum += (double) values[i];
+            stats.count++;
+            if (values[i] < stats.min) {
+                stats.min = values[i];
+            }
+            if (values[i] > stats.max) {
+                stats.max = values[i];
+            }
+        }
+    }
+}
+
+static bool same_stats(const column_stats& a, const column_stats& b) {
+    return a.count == b.count && a.min == b.min && a.max == b.max &&
+           std::fabs(a.sum - b.sum) <= 1e-9 * (std::fabs(b.sum) + 1);
+}
+
+int main(int argc, char** argv) {
+    size_t n = (size_t) (argc > 1 ? atof(argv[1]) : 16) * 1024 * 1024;
+    int repeats = argc > 2 ? atoi(argv[2]) : 5;
+    size_t mean_run = argc > 3 ? (size_t) atoll(argv[3]) : 1000;
+    if (n == 0 || repeats < 1 || mean_run < 1) {
+        fprintf(stderr, "Usage: %s [millions of values] [repeats] [mean run of a group]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> hundredths(-1000, 4500);
+    std::uniform_int_distribution<int> coin(0, 1);
+    std::uniform_int_distribution<size_t> run_length(1, 2 * mean_run);
+    std::vector<float> values(n);
+    std::vector<uint8_t> mask(n);
+    std::vector<uint32_t> groups(n);
+    uint32_t group = 0;
+    size_t left = run_length(random);
+    for (size_t i = 0; i < n; i++) {
+        values[i] = (float) hundredths(random) / 100.0f;
+        mask[i] = (uint8_t) coin(random);
+        if (left-- == 0) {
+            group++;
+            left = run_length(random) - 1;
+        }
+        groups[i] = group;
+    }
+    printf("Values: %zu, groups: %u\n", n, group + 1);
+#if defined(__AVX2__)
+    printf("Kernels: AVX2\n");
+#elif defined(__SSE2__)
+    printf("Kernels: SSE2\n");
+#else
+    printf("Kernels: scalar\n");
+#endif
+
+    double bytes = (double) n * sizeof(float);
+    bool same = true;
+    const uint8_t* masks[2] = {NULL, mask.data()};
+    const char* mask_names[2] = {"all", "masked"};
+    for (int m = 0; m < 2; m++) {
+        double best_scalar = 1e30, best_kernel = 1e30;
+        column_stats expected = {0, 0, 0, 0}, result = {0, 0, 0, 0};
+        for (int r = 0; r < repeats; r++) {
+            auto start = std::chrono::steady_clock::now();
+            expected = scalar_stats(values.data(), masks[m], n);
+            best_scalar = std::min(best_scalar, seconds_since(start));
+            start = std::chrono::steady_clock::now();
+            result = masked_stats(values.data(), masks[m], n);
+            best_kernel = std::min(best_kernel, seconds_since(start));
+        }
+        same = same && same_stats(result, expected);
+        printf("Stats (%s): scalar %.2f GB/s, kernel %.2f GB/s, speedup %.2fx\n", mask_names[m],
+               bytes / best_scalar / 1e9, bytes / best_kernel / 1e9, best_scalar / best_kernel);
+    }
+
+    std::vector<group_stats> expected, result;
+    for (int m = 0; m < 2; m++) {
+        double best_scalar = 1e30, best_kernel = 1e30;
+        for (int r = 0; r < repeats; r++) {
+            auto start = std::chrono::steady_clock::now();
+            scalar_segmented(values.data(), masks[m], groups.data(), n, expected);
+            best_scalar = std::min(best_scalar, seconds_since(start));
+            start = std::chrono::steady_clock::now();
+            segmented_stats(values.data(), masks[m], groups.data(), n, result);
+            best_kernel = std::min(best_kernel, seconds_since(start));
+        }
+        same = same && result.size() == expected.size();
+        for (size_t g = 0; same && g < result.size(); g++) {
+            same = result[g].group == expected[g].group && result[g].first == expected[g].first &&
+                   same_stats(result[g].stats, expected[g].stats);
+        }
+        printf("Segmented stats (%s): scalar %.2f GB/s, kernel %.2f GB/s, speedup %.2fx\n", mask_names[m],
+               bytes / best_scalar / 1e9, bytes / best_kernel / 1e9, best_scalar / best_kernel);
+    }
+    printf("Results %s\n", same ? "equal" : "DIFFERENT");
+    return same ? 0 : 1;
+}
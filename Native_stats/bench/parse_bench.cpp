@@ -0,0 +1,128 @@
+//Microbenchmark of the CSV parser: the rows of a file are repeated in memory up to
+//the requested size and parsed several times, reporting the throughput of the
+//separator scan alone, of the whole parser and of a line-by-line parser with strtof.
+#include "../src/csv_parser.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Reference parser: every line is split with memchr and the numbers are read with strtof
+static double parse_reference(const char* data, size_t len, size_t* rows) {
+    double checksum = 0;
+    const char* p = (const char *) memchr(data, '\n', len) + 1;
+    const char* end = data + len;
+    *rows = 0;
+    while (p < end) {
+        const char* line_end = (const char *) memchr(p, '\n', end - p);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+        const char* f1 = (const char *) memchr(p, ';', line_end - p) + 1;
+        const char* f2 = (const char *) memchr(f1, ';', line_end - f1) + 1;
+        const char* f3 = (const char *) memchr(f2, ';', line_end - f2) + 1;
+        //Copies, as sscanf and strtof need terminated strings
+        std::string time(f1, f2 - 1);
+        std::string temperature(f2, f3 - 1);
+        std::string humidity(f3, line_end);
+        int year, month, day, hour, minute;
+        sscanf(time.c_str(), "%d-%d-%d %d:%d", &year, &month, &day, &hour, &minute);
+        checksum += strtof(temperature.c_str(), NULL) + strtof(humidity.c_str(), NULL) + minute;
+        (*rows)++;
+        p = line_end + 1;
+    }
+    return checksum;
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "../DataOut/dataset.csv";
+    size_t target = (size_t) (argc > 2 ? atof(argv[2]) : 256) * 1024 * 1024;
+    int repeats = argc > 3 ? atoi(argv[3]) : 5;
+
+    mapped_file file;
+    if (!map_file(path, file) || file.len == 0) {
+        fprintf(stderr, "Usage: %s [csv] [MB] [repeats]\n", argv[0]);
+        return 1;
+    }
+    //Header once, then the rows repeated
+    const char* body = (const char *) memchr(file.data, '\n', file.len) + 1;
+    size_t body_len = file.len - (body - file.data);
+    std::string text(file.data, body - file.data);
+    while (text.size() < target) {
+        text.append(body, body_len);
+        if (text.back() != '\n') {
+            text.push_back('\n');
+        }
+    }
+    double megabytes = text.size() / (1024.0 * 1024.0);
+    printf("Input: %s repeated to %.1f MB\n", path, megabytes);
+
+    //Fast float parsing must give the same floats as strtof
+    size_t mismatches = 0;
+    reading_parser parser;
+    parser_init(parser, file.data, file.len);
+    sensor_row row;
+    size_t checked = 0;
+    while (parser_next(parser, row)) {
+        checked++;
+    }
+    const char* p = body;
+    const char* end = file.data + file.len;
+    while (p < end) {
+        const char* line_end = (const char *) memchr(p, '\n', end - p);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+        const char* f2 = (const char *) memchr(p, ';', line_end - p);
+        f2 = f2 != NULL ? (const char *) memchr(f2 + 1, ';', line_end - f2 - 1) : NULL;
+        const char* f3 = f2 != NULL ? (const char *) memchr(f2 + 1, ';', line_end - f2 - 1) : NULL;
+        if (f3 != NULL) {
+            float fast, reference;
+            std::string temperature(f2 + 1, f3);
+            if (parse_float(f2 + 1, f3 - f2 - 1, &fast)) {
+                reference = strtof(temperature.c_str(), NULL);
+                mismatches += memcmp(&fast, &reference, sizeof(float)) != 0;
+            }
+        }
+        p = line_end + 1;
+    }
+    printf("Rows of the file: %zu, floats different from strtof: %zu\n", checked, mismatches);
+
+    double best_scan = 1e30, best_parse = 1e30, best_reference = 1e30;
+    size_t rows = 0, reference_rows = 0, separators = 0;
+    double checksum = 0;
+    std::vector<uint32_t> positions(parser_block_size);
+    for (int r = 0; r < repeats; r++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t block = 0; block < text.size(); block += parser_block_size) {
+            size_t len = text.size() - block < parser_block_size ? text.size() - block : parser_block_size;
+            separators += find_separators(text.data() + block, len, 0, positions.data());
+        }
+        best_scan = std::min(best_scan, seconds_since(start));
+
+        start = std::chrono::steady_clock::now();
+        parser_init(parser, text.data(), text.size());
+        rows = 0;
+        while (parser_next(parser, row)) {
+            checksum += row.temperature + row.humidity + (double) row.local_seconds;
+            rows++;
+        }
+        best_parse = std::min(best_parse, seconds_since(start));
+
+        start = std::chrono::steady_clock::now();
+        checksum += parse_reference(text.data(), text.size(), &reference_rows);
+        best_reference = std::min(best_reference, seconds_since(start));
+    }
+    printf("Separator scan: %.1f MB/s (%zu separators)\n", megabytes / best_scan, separators / repeats);
+    printf("Parser: %.1f MB/s, %.1f M rows/s (%zu rows)\n", megabytes / best_parse, rows / best_parse / 1e6, rows);
+    printf("memchr + sscanf + strtof: %.1f MB/s (%zu rows)\n", megabytes / best_reference, reference_rows);
+    printf("Checksum: %g\n", checksum);
+    unmap_file(file);
+    return 0;
+}
@@ -0,0 +1,59 @@
+"""Compare the tables written by native_stats with the part files written by Spark.
+
+The rows of every table are compared as sorted lists, because Spark splits a table
+among part files in the order of its shuffle partitions.
+"""
+import argparse
+import glob
+import os
+import sys
+
+
+def read_spark_table(directory):
+    header = None
+    rows = []
+    for path in sorted(glob.glob(os.path.join(directory, "part-*.csv"))):
+        with open(path, "rb") as part:
+            lines = part.read().splitlines()
+        if lines:
+            header = lines[0]
+            rows.extend(lines[1:])
+    return header, rows
+
+
+def read_native_table(path):
+    with open(path, "rb") as table:
+        lines = table.read().splitlines()
+    return lines[0], lines[1:]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--spark", default="../Stats", help="directory of the Spark tables")
+    parser.add_argument("--native", default="./Stats", help="directory of the native tables")
+    args = parser.parse_args()
+
+    failures = 0
+    for directory in sorted(glob.glob(os.path.join(args.spark, "*"))):
+        name = os.path.basename(directory)
+        native_path = os.path.join(args.native, name + ".csv")
+        if not os.path.exists(native_path):
+            print("%s: missing" % name)
+            failures += 1
+            continue
+        spark_header, spark_rows = read_spark_table(directory)
+        native_header, native_rows = read_native_table(native_path)
+        spark_rows.sort()
+        native_rows.sort()
+        different = sum(1 for a, b in zip(spark_rows, native_rows) if a != b)
+        if spark_header != native_header or len(spark_rows) != len(native_rows) or different:
+            print("%s: header %s, %d/%d rows, %d different" % (name, "ok" if spark_header == native_header else "different",
+                                                            len(native_rows), len(spark_rows), different))
+            failures += 1
+        else:
+            print("%s: %d rows identical" % (name, len(spark_rows)))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
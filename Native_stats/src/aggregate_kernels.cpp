@@ -0,0 +1,174 @@
+#include "aggregate_kernels.h"
+
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static const float positive_infinity = std::numeric_limits<float>::infinity();
+
+//Plain loop, for the tail of the vector loops
+static void add_scalar(column_stats& stats, const float* values, const uint8_t* mask, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        if (mask == NULL || mask[i] != 0) {
+            float value = values[i];
+            stats.sum += (double) value;
+            stats.count++;
+            stats.min = value < stats.min ? value : stats.min;
+            stats.max = value > stats.max ? value : stats.max;
+        }
+    }
+}
+
+column_stats masked_stats(const float* values, const uint8_t* mask, size_t n) {
+    column_stats stats = {0, 0, positive_infinity, -positive_infinity};
+    size_t i = 0;
+#if defined(__AVX2__)
+    //8 values at a time; the sum in two vectors of 4 doubles
+    __m256d sum_low = _mm256_setzero_pd();
+    __m256d sum_high = _mm256_setzero_pd();
+    __m256i counts = _mm256_setzero_si256();
+    __m256 minimum = _mm256_set1_ps(positive_infinity);
+    __m256 maximum = _mm256_set1_ps(-positive_infinity);
+    const __m256 infinities = _mm256_set1_ps(positive_infinity);
+    const __m256 negative_infinities = _mm256_set1_ps(-positive_infinity);
+    for (; i + 8 <= n; i += 8) {
+        __m256 block = _mm256_loadu_ps(values + i);
+        __m256 selected;
+        if (mask != NULL) {
+            __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (mask + i)));
+            __m256i lanes = _mm256_xor_si256(_mm256_cmpeq_epi32(bytes, _mm256_setzero_si256()), _mm256_set1_epi32(-1));
+            selected = _mm256_castsi256_ps(lanes);
+            counts = _mm256_sub_epi32(counts, lanes);
+        } else {
+            selected = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            counts = _mm256_add_epi32(counts, _mm256_set1_epi32(1));
+        }
+        __m256 kept = _mm256_and_ps(block, selected);
+        sum_low = _mm256_add_pd(sum_low, _mm256_cvtps_pd(_mm256_castps256_ps128(kept)));
+        sum_high = _mm256_add_pd(sum_high, _mm256_cvtps_pd(_mm256_extractf128_ps(kept, 1)));
+        minimum = _mm256_min_ps(minimum, _mm256_blendv_ps(infinities, block, selected));
+        maximum = _mm256_max_ps(maximum, _mm256_blendv_ps(negative_infinities, block, selected));
+        //The counts of the lanes are moved to the total before they can overflow
+        if ((i & ((1 << 30) - 8)) == 0 && i > 0) {
+            alignas(32) uint32_t lane_counts[8];
+            _mm256_store_si256((__m256i *) lane_counts, counts);
+            for (uint32_t count : lane_counts) {
+                stats.count += count;
+            }
+            counts = _mm256_setzero_si256();
+        }
+    }
+    alignas(32) double sums[4];
+    _mm256_store_pd(sums, _mm256_add_pd(sum_low, sum_high));
+    stats.sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    alignas(32) uint32_t lane_counts[8];
+    _mm256_store_si256((__m256i *) lane_counts, counts);
+    alignas(32) float minimums[8];
+    alignas(32) float maximums[8];
+    _mm256_store_ps(minimums, minimum);
+    _mm256_store_ps(maximums, maximum);
+    for (int lane = 0; lane < 8; lane++) {
+        stats.count += lane_counts[lane];
+        stats.min = minimums[lane] < stats.min ? minimums[lane] : stats.min;
+        stats.max = maximums[lane] > stats.max ? maximums[lane] : stats.max;
+    }
+#elif defined(__SSE2__)
+    //4 values at a time; the sum in two vectors of 2 doubles
+    __m128d sum_low = _mm_setzero_pd();
+    __m128d sum_high = _mm_setzero_pd();
+    __m128i counts = _mm_setzero_si128();
+    __m128 minimum = _mm_set1_ps(positive_infinity);
+    __m128 maximum = _mm_set1_ps(-positive_infinity);
+    const __m128 infinities = _mm_set1_ps(positive_infinity);
+    const __m128 negative_infinities = _mm_set1_ps(-positive_infinity);
+    for (; i + 4 <= n; i += 4) {
+        __m128 block = _mm_loadu_ps(values + i);
+        __m128 selected;
+        if (mask != NULL) {
+            int32_t four;
+            __builtin_memcpy(&four, mask + i, sizeof(four));
+            __m128i bytes = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(four), _mm_setzero_si128()),
+                                               _mm_setzero_si128());
+            __m128i lanes = _mm_xor_si128(_mm_cmpeq_epi32(bytes, _mm_setzero_si128()), _mm_set1_epi32(-1));
+            selected = _mm_castsi128_ps(lanes);
+            counts = _mm_sub_epi32(counts, lanes);
+        } else {
+            selected = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            counts = _mm_add_epi32(counts, _mm_set1_epi32(1));
+        }
+        __m128 kept = _mm_and_ps(block, selected);
+        sum_low = _mm_add_pd(sum_low, _mm_cvtps_pd(kept));
+        sum_high = _mm_add_pd(sum_high, _mm_cvtps_pd(_mm_movehl_ps(kept, kept)));
+        //No blendv in SSE2: and/andnot/or
+        minimum = _mm_min_ps(minimum, _mm_or_ps(_mm_and_ps(selected, block), _mm_andnot_ps(selected, infinities)));
+        maximum = _mm_max_ps(maximum, _mm_or_ps(_mm_and_ps(selected, block), _mm_andnot_ps(selected, negative_infinities)));
+        if ((i & ((1 << 30) - 4)) == 0 && i > 0) {
+            alignas(16) uint32_t lane_counts[4];
+            _mm_store_si128((__m128i *) lane_counts, counts);
+            for (uint32_t count : lane_counts) {
+                stats.count += count;
+            }
+            counts = _mm_setzero_si128();
+        }
+    }
+    alignas(16) double sums[2];
+    _mm_store_pd(sums, _mm_add_pd(sum_low, sum_high));
+    stats.sum = sums[0] + sums[1];
+    alignas(16) uint32_t lane_counts[4];
+    _mm_store_si128((__m128i *) lane_counts, counts);
+    alignas(16) float minimums[4];
+    alignas(16) float maximums[4];
+    _mm_store_ps(minimums, minimum);
+    _mm_store_ps(maximums, maximum);
+    for (int lane = 0; lane < 4; lane++) {
+        stats.count += lane_counts[lane];
+        stats.min = minimums[lane] < stats.min ? minimums[lane] : stats.min;
+        stats.max = maximums[lane] > stats.max ? maximums[lane] : stats.max;
+    }
+#endif
+    add_scalar(stats, values, mask, i, n);
+    return stats;
+}
+
+//End of the run of groups[begin] in sorted groups: exponential then binary search, so a
+//long run costs a logarithmic number of comparisons
+static size_t run_end(const uint32_t* groups, size_t begin, size_t n) {
+    uint32_t group = groups[begin];
+    size_t low = begin + 1;
+    size_t step = 1;
+    size_t high = low;
+    while (high < n && groups[high] == group) {
+        low = high + 1;
+        high = begin + (step *= 2);
+    }
+    if (high > n) {
+        high = n;
+    }
+    //groups[low - 1] == group, groups[high] != group (or high == n)
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (groups[middle] == group) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void segmented_stats(const float* values, const uint8_t* mask, const uint32_t* groups, size_t n,
+                     std::vector<group_stats>& out) {
+    out.clear();
+    size_t begin = 0;
+    while (begin < n) {
+        size_t end = run_end(groups, begin, n);
+        group_stats run;
+        run.group = groups[begin];
+        run.first = begin;
+        run.stats = masked_stats(values + begin, mask == NULL ? NULL : mask + begin, end - begin);
+        out.push_back(run);
+        begin = end;
+    }
+}
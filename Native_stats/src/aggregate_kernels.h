@@ -0,0 +1,37 @@
+#ifndef AGGREGATE_KERNELS_H
+#define AGGREGATE_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Aggregation kernels over float columns: sum, count, min and max of the values selected
+//by a mask, and the same for every run of equal ids of a sorted group column. They use
+//AVX2 when compiled with -mavx2, SSE2 otherwise (and plain loops without either).
+//The sums are accumulated as doubles in several lanes, so their last bits can differ
+//from the ones of a loop that adds the values in order; count, min and max are exact.
+
+struct column_stats {
+    double sum;
+    size_t count;
+    //+inf and -inf when nothing is selected
+    float min;
+    float max;
+};
+
+//Statistics of a run of equal ids of the group column
+struct group_stats {
+    uint32_t group;
+    size_t first;
+    column_stats stats;
+};
+
+//Statistics of values[i] for the i where mask[i] != 0 (all of them when mask is NULL)
+column_stats masked_stats(const float* values, const uint8_t* mask, size_t n);
+
+//Statistics of every run of equal ids of groups (sorted, or at least with the rows of
+//a group contiguous), in the order of the runs; mask as in masked_stats
+void segmented_stats(const float* values, const uint8_t* mask, const uint32_t* groups, size_t n,
+                     std::vector<group_stats>& out);
+
+#endif
@@ -0,0 +1,124 @@
+#include "bucket_index.h"
+
+#include <algorithm>
+
+static const bucket_cell empty_bucket = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+
+static inline void cell_merge(bucket_cell& into, const bucket_cell& from) {
+    partial_merge(into.temperature, from.temperature);
+    partial_merge(into.humidity, from.humidity);
+}
+
+//Inner nodes from the leaves
+static void build_tree(bucket_series& series) {
+    for (size_t k = series.capacity - 1; k >= 1; k--) {
+        series.tree[k] = series.tree[2 * k];
+        cell_merge(series.tree[k], series.tree[2 * k + 1]);
+    }
+}
+
+//Leaves from the partials of the hours, then the tree
+static void set_leaves(bucket_series& series, const std::vector<bucket_cell>& leaves) {
+    series.capacity = 1;
+    while (series.capacity < std::max(leaves.size(), (size_t) 1)) {
+        series.capacity *= 2;
+    }
+    series.tree.assign(2 * series.capacity, empty_bucket);
+    std::copy(leaves.begin(), leaves.end(), series.tree.begin() + series.capacity);
+    build_tree(series);
+}
+
+//Rows sorted by location of the level and hour; consecutive rows of the same hour are
+//merged in one leaf
+static void build_level(const dataset& data, int level, std::vector<bucket_series>& series) {
+    int32_t min_hour = data.size() > 0 ? hour_of(*std::min_element(data.epoch.begin(), data.epoch.end())) : 0;
+    std::vector<std::pair<uint64_t, uint32_t>> keys(data.size());
+    for (uint32_t i = 0; i < keys.size(); i++) {
+        keys[i].first = ((uint64_t) data.location(level, i) << 32) | (uint64_t) (hour_of(data.epoch[i]) - min_hour);
+        keys[i].second = i;
+    }
+    std::sort(keys.begin(), keys.end());
+    series.assign(data.locations.slots(level), bucket_series());
+    std::vector<bucket_cell> leaves;
+    size_t i = 0;
+    while (i < keys.size()) {
+        uint32_t key = (uint32_t) (keys[i].first >> 32);
+        bucket_series& location = series[key];
+        leaves.clear();
+        for (; i < keys.size() && (uint32_t) (keys[i].first >> 32) == key; i++) {
+            int32_t hour = min_hour + (int32_t) (keys[i].first & 0xffffffffu);
+            if (location.hours.empty() || location.hours.back() != hour) {
+                location.hours.push_back(hour);
+                leaves.push_back(empty_bucket);
+            }
+            uint32_t row = keys[i].second;
+            partial_add(leaves.back().temperature, data.temperature[row]);
+            partial_add(leaves.back().humidity, data.humidity[row]);
+        }
+        set_leaves(location, leaves);
+    }
+}
+
+void build_bucket_index(const dataset& data, bucket_index& index) {
+    for (int level = 0; level < level_count; level++) {
+        build_level(data, level, index.series[level]);
+    }
+}
+
+static void series_add(bucket_series& series, int32_t hour, float temperature, float humidity) {
+    auto found = std::lower_bound(series.hours.begin(), series.hours.end(), hour);
+    size_t leaf = (size_t) (found - series.hours.begin());
+    if (found == series.hours.end() || *found != hour) {
+        //A new hour: at the end (the usual case) it takes the next leaf, doubling the
+        //tree when it is full; in the middle the leaves are moved and the tree rebuilt
+        bool at_end = found == series.hours.end();
+        series.hours.insert(found, hour);
+        if (at_end && series.hours.size() <= series.capacity) {
+            series.tree[series.capacity + leaf] = empty_bucket;
+        } else {
+            std::vector<bucket_cell> leaves(series.tree.begin() + series.capacity,
+                                            series.tree.begin() + series.capacity + (series.hours.size() - 1));
+            leaves.insert(leaves.begin() + leaf, empty_bucket);
+            set_leaves(series, leaves);
+        }
+    }
+    size_t k = series.capacity + leaf;
+    partial_add(series.tree[k].temperature, temperature);
+    partial_add(series.tree[k].humidity, humidity);
+    for (k /= 2; k >= 1; k /= 2) {
+        series.tree[k] = series.tree[2 * k];
+        cell_merge(series.tree[k], series.tree[2 * k + 1]);
+    }
+}
+
+void bucket_add(bucket_index& index, const location_dictionary& locations, uint32_t room, int64_t epoch,
+                float temperature, float humidity) {
+    for (int level = 0; level < level_count; level++) {
+        std::vector<bucket_series>& series = index.series[level];
+        uint32_t key = locations.key(level, room);
+        if (key >= series.size()) {
+            series.resize(key + 1);
+        }
+        series_add(series[key], hour_of(epoch), temperature, humidity);
+    }
+}
+
+bucket_cell bucket_query(const bucket_index& index, int level, uint32_t key, int32_t first_hour, int32_t last_hour) {
+    bucket_cell result = empty_bucket;
+    if (key >= index.series[level].size() || first_hour > last_hour) {
+        return result;
+    }
+    const bucket_series& series = index.series[level][key];
+    //Leaves [begin, end) of the hours asked for, then the nodes that cover them exactly
+    size_t begin = (size_t) (std::lower_bound(series.hours.begin(), series.hours.end(), first_hour) - series.hours.begin());
+    size_t end = (size_t) (std::upper_bound(series.hours.begin(), series.hours.end(), last_hour) - series.hours.begin());
+    for (size_t low = begin + series.capacity, high = end + series.capacity; low < high; low /= 2, high /= 2) {
+        if (low & 1) {
+            cell_merge(result, series.tree[low++]);
+        }
+        if (high & 1) {
+            cell_merge(result, series.tree[--high]);
+        }
+    }
+    return result;
+}
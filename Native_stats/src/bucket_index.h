@@ -0,0 +1,53 @@
+#ifndef BUCKET_INDEX_H
+#define BUCKET_INDEX_H
+
+#include "dataset.h"
+#include "rollup.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Index of the readings by (location, hour): every location of every level has the
+//partials (sum, count, min, max of temperature and humidity) of its hours with readings,
+//kept as the leaves of a segment tree whose inner nodes merge their two children. The
+//statistics of any period are the merge of O(log n) nodes, n the hours with readings of
+//the location, whatever the length of the period; floors, buildings and neighborhoods
+//have their own trees, so a query on them does not visit their rooms.
+
+//Partials of one hour, or of the hours under a node of the tree
+struct bucket_cell {
+    partial temperature;
+    partial humidity;
+};
+
+struct bucket_series {
+    //Hours (UTC, since the epoch) with readings, increasing: leaf i is hours[i]
+    std::vector<int32_t> hours;
+    //Nodes of the tree: the root is 1, the children of node k are 2k and 2k + 1, leaf i
+    //is capacity + i; capacity is a power of two, doubled when the leaves are full
+    std::vector<bucket_cell> tree;
+    size_t capacity = 0;
+};
+
+struct bucket_index {
+    //series[level][key] for the keys of the level in the location dictionary
+    std::vector<bucket_series> series[level_count];
+};
+
+//Hour of a UTC instant (Rome is a whole number of hours from UTC, so the local hours
+//are the same buckets)
+inline int32_t hour_of(int64_t epoch) {
+    return (int32_t) (epoch >= 0 ? epoch / 3600 : (epoch - 3599) / 3600);
+}
+
+void build_bucket_index(const dataset& data, bucket_index& index);
+
+//Add a reading of a room of the dictionary, at every level
+void bucket_add(bucket_index& index, const location_dictionary& locations, uint32_t room, int64_t epoch,
+                float temperature, float humidity);
+
+//Partials of the readings of the location of the level in the hours [first_hour, last_hour]
+bucket_cell bucket_query(const bucket_index& index, int level, uint32_t key, int32_t first_hour, int32_t last_hour);
+
+#endif
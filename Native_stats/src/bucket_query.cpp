@@ -0,0 +1,217 @@
+//Range queries on the history of the readings through the (location, hour) index of
+//src/bucket_index.cpp. Every line of the standard input is a query
+//  <location>;<from>;<to>
+//where the location is a room code or the name of a floor, building or neighborhood and
+//from and to are local times (yyyy-MM-dd HH:mm[:ss]); the period is [from, to) in whole
+//hours. Every answer is a line
+//  location;from;to;readings;avg_temp;min_temp;max_temp;avg_hum;min_hum;max_hum
+//--bench answers random queries instead and compares them with a scan of all the readings,
+//and with an index built from the first half of the rows that gets the others by bucket_add.
+#include "bucket_index.h"
+#include "csv_parser.h"
+#include "rome_time.h"
+#include "spark_number.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+struct location_ref {
+    int level;
+    uint32_t key;
+};
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static char* write_float(char* out, float value) {
+    return std::to_chars(out, out + 32, value).ptr;
+}
+
+//readings;avg_temp;min_temp;max_temp;avg_hum;min_hum;max_hum (only readings when there are none)
+static char* write_cell(char* out, const bucket_cell& cell) {
+    out += sprintf(out, "%lld", cell.temperature.count);
+    if (cell.temperature.count == 0) {
+        return out;
+    }
+    const partial* partials[2] = {&cell.temperature, &cell.humidity};
+    for (const partial* values : partials) {
+        *out++ = ';';
+        out = write_rounded(out, bround2(values->sum / (double) values->count));
+        *out++ = ';';
+        out = write_float(out, values->min);
+        *out++ = ';';
+        out = write_float(out, values->max);
+    }
+    return out;
+}
+
+//Partials of the same period computed from all the readings
+static bucket_cell scan(const dataset& data, int level, uint32_t key, int32_t first_hour, int32_t last_hour) {
+    bucket_cell cell = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+    for (size_t i = 0; i < data.size(); i++) {
+        int32_t hour = hour_of(data.epoch[i]);
+        if (data.location(level, i) == key && hour >= first_hour && hour <= last_hour) {
+            partial_add(cell.temperature, data.temperature[i]);
+            partial_add(cell.humidity, data.humidity[i]);
+        }
+    }
+    return cell;
+}
+
+static bool same_cell(const bucket_cell& a, const bucket_cell& b) {
+    const partial* x[2] = {&a.temperature, &a.humidity};
+    const partial* y[2] = {&b.temperature, &b.humidity};
+    for (int v = 0; v < 2; v++) {
+        if (x[v]->count != y[v]->count ||
+            (x[v]->count > 0 && (x[v]->min != y[v]->min || x[v]->max != y[v]->max ||
+                                 std::fabs(x[v]->sum - y[v]->sum) > 1e-9 * (std::fabs(y[v]->sum) + 1)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//Index of the first half of the rows, then the other rows added one at a time: the odd
+//ones first, then the even ones, so that new hours go at the end of a series (doubling
+//its tree), in the middle of it and in the series of new locations
+static double build_by_adding(const dataset& data, bucket_index& index) {
+    dataset half = data;
+    size_t n = data.size() / 2;
+    half.room.resize(std::min(half.room.size(), n));
+    half.epoch.resize(std::min(half.epoch.size(), n));
+    half.day.resize(std::min(half.day.size(), n));
+    half.hour.resize(std::min(half.hour.size(), n));
+    half.temperature.resize(std::min(half.temperature.size(), n));
+    half.humidity.resize(std::min(half.humidity.size(), n));
+    build_bucket_index(half, index);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t first = n + 1; first >= n; first--) {
+        for (size_t i = first; i < data.size(); i += 2) {
+            bucket_add(index, data.locations, data.room[i], data.epoch[i], data.temperature[i], data.humidity[i]);
+        }
+    }
+    return elapsed_ms(start);
+}
+
+//Random queries of periods of growing length: the time of the index stays about the same
+static int benchmark(const dataset& data, const bucket_index& index, int queries) {
+    bucket_index added;
+    double add_time = build_by_adding(data, added);
+    size_t added_rows = data.size() - data.size() / 2;
+    printf("bucket_add of %zu rows (half of them in the middle of their series): %.4f ms per row\n", added_rows,
+           add_time / (double) std::max(added_rows, (size_t) 1));
+    std::mt19937 random(7);
+    int32_t first = hour_of(*std::min_element(data.epoch.begin(), data.epoch.end()));
+    int32_t last = hour_of(*std::max_element(data.epoch.begin(), data.epoch.end()));
+    const int32_t lengths[] = {24, 24 * 7, 24 * 30, 24 * 365, last - first + 1};
+    const char* names[] = {"1 day", "1 week", "30 days", "1 year", "all the history"};
+    bool same = true;
+    for (int l = 0; l < 5; l++) {
+        double index_time = 0;
+        double scan_time = 0;
+        for (int q = 0; q < queries; q++) {
+            int level = (int) (random() % level_count);
+            uint32_t row = (uint32_t) (random() % data.size());
+            uint32_t key = data.location(level, row);
+            int32_t span = std::max(last - first + 1 - lengths[l], 1);
+            int32_t from = first + (int32_t) (random() % (uint32_t) span);
+            int32_t to = from + lengths[l] - 1;
+            auto start = std::chrono::steady_clock::now();
+            bucket_cell cell = bucket_query(index, level, key, from, to);
+            index_time += elapsed_ms(start);
+            start = std::chrono::steady_clock::now();
+            bucket_cell expected = scan(data, level, key, from, to);
+            scan_time += elapsed_ms(start);
+            same = same && same_cell(cell, expected) && same_cell(bucket_query(added, level, key, from, to), expected);
+        }
+        printf("Period of %s: index %.4f ms, scan %.4f ms per query\n", names[l], index_time / queries,
+               scan_time / queries);
+    }
+    printf("Results %s\n", same ? "equal" : "DIFFERENT");
+    return same ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    const char* input = "../DataOut/dataset.csv";
+    bool bench = false;
+    int queries = 1000;
+
+    //--input <path> is the CSV or the snapshot of the readings (default ../DataOut/dataset.csv)
+    //--bench <n> answers n random queries for every length of period and times them
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--input") == 0 && a + 1 < argc) {
+            input = argv[++a];
+        } else if (strcmp(argv[a], "--bench") == 0 && a + 1 < argc) {
+            bench = true;
+            queries = atoi(argv[++a]);
+        } else {
+            fprintf(stderr, "Usage: %s [--input <csv|snapshot>] [--bench <queries>]\n", argv[0]);
+            return 1;
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    dataset data;
+    if (!load_dataset(input, data) || data.size() == 0) {
+        fprintf(stderr, "Cannot read %s\n", input);
+        return 1;
+    }
+    double load_time = elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    bucket_index index;
+    build_bucket_index(data, index);
+    fprintf(stderr, "Rows: %zu, load %.3f ms, index %.3f ms\n", data.size(), load_time, elapsed_ms(start));
+    if (bench) {
+        return benchmark(data, index, std::max(queries, 1));
+    }
+
+    //A room first, so that a room code is not taken for a location of another level
+    std::unordered_map<std::string, location_ref> locations;
+    for (int level = level_count - 1; level >= 0; level--) {
+        for (uint32_t key = 0; key < data.locations.names[level].size(); key++) {
+            if (!data.locations.names[level][key].empty()) {
+                locations[data.locations.names[level][key]] = location_ref{level, key};
+            }
+        }
+    }
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    char text[512];
+    while ((len = getline(&line, &capacity, stdin)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        char* from = strchr(line, ';');
+        char* to = from == NULL ? NULL : strchr(from + 1, ';');
+        int64_t from_local, to_local;
+        if (to == NULL || !parse_timestamp(from + 1, to - from - 1, &from_local) ||
+            !parse_timestamp(to + 1, strlen(to + 1), &to_local)) {
+            fprintf(stderr, "Invalid query %s\n", line);
+            continue;
+        }
+        *from = '\0';
+        auto found = locations.find(line);
+        if (found == locations.end()) {
+            fprintf(stderr, "Unknown location %s\n", line);
+            continue;
+        }
+        *from = ';';
+        int32_t first_hour = hour_of(rome_to_epoch(from_local));
+        int32_t last_hour = hour_of(rome_to_epoch(to_local) - 1);
+        bucket_cell cell = bucket_query(index, found->second.level, found->second.key, first_hour, last_hour);
+        char* p = write_cell(text, cell);
+        *p = '\0';
+        printf("%s;%s\n", line, text);
+    }
+    free(line);
+    return 0;
+}
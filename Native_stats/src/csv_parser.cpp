@@ -0,0 +1,269 @@
+#include "csv_parser.h"
+#include "rome_time.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+bool map_file(const char* path, mapped_file& file) {
+    file.data = NULL;
+    file.len = 0;
+    file.mapped = false;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, (size_t) info.st_size, MADV_SEQUENTIAL);
+            file.data = (const char *) data;
+            file.len = (size_t) info.st_size;
+            file.mapped = true;
+            close(fd);
+            return true;
+        }
+    }
+    //Not a regular file (e.g. a pipe): read it
+    size_t cap = 1 << 20;
+    char* buffer = (char *) malloc(cap);
+    ssize_t n;
+    while ((n = read(fd, buffer + file.len, cap - file.len)) > 0) {
+        file.len += (size_t) n;
+        if (file.len == cap) {
+            cap *= 2;
+            buffer = (char *) realloc(buffer, cap);
+        }
+    }
+    close(fd);
+    file.data = buffer;
+    return n == 0;
+}
+
+void unmap_file(mapped_file& file) {
+    if (file.mapped) {
+        munmap((void *) file.data, file.len);
+    } else {
+        free((void *) file.data);
+    }
+    file.data = NULL;
+    file.len = 0;
+}
+
+size_t find_separators(const char* data, size_t len, uint32_t offset, uint32_t* positions) {
+    size_t pos = 0;
+    size_t n = 0;
+#if defined(__AVX2__)
+    const __m256i semicolons = _mm256_set1_epi8(';');
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    while (pos + 32 <= len) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (data + pos));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_cmpeq_epi8(block, semicolons), _mm256_cmpeq_epi8(block, newlines)));
+        while (mask != 0) {
+            positions[n++] = offset + (uint32_t) (pos + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+        pos += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i semicolons = _mm_set1_epi8(';');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    while (pos + 16 <= len) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (data + pos));
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(block, semicolons), _mm_cmpeq_epi8(block, newlines)));
+        while (mask != 0) {
+            positions[n++] = offset + (uint32_t) (pos + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+        pos += 16;
+    }
+#endif
+    for (; pos < len; pos++) {
+        if (data[pos] == ';' || data[pos] == '\n') {
+            positions[n++] = offset + (uint32_t) pos;
+        }
+    }
+    return n;
+}
+
+//Index the next block, keeping the separators not parsed yet
+static void parser_refill(reading_parser& parser) {
+    size_t shift = parser.line - parser.base;
+    size_t kept = 0;
+    for (size_t i = parser.next; i < parser.count; i++) {
+        parser.separators[kept++] = (uint32_t) (parser.separators[i] - shift);
+    }
+    parser.next = 0;
+    parser.base = parser.line;
+
+    size_t block = parser.len - parser.indexed < parser_block_size ? parser.len - parser.indexed : parser_block_size;
+    if (parser.separators.size() < kept + block + 1) {
+        parser.separators.resize(kept + block + 1);
+    }
+    parser.count = kept + find_separators(parser.data + parser.indexed, block, (uint32_t) (parser.indexed - parser.base),
+                                          &parser.separators[kept]);
+    parser.indexed += block;
+    //The last line may not end with a new line
+    if (parser.indexed == parser.len && parser.len > 0 && parser.data[parser.len - 1] != '\n') {
+        parser.separators[parser.count++] = (uint32_t) (parser.len - parser.base);
+    }
+}
+
+void parser_init(reading_parser& parser, const char* data, size_t len) {
+    //Skip the header
+    const char* header_end = (const char *) memchr(data, '\n', len);
+    parser.data = data;
+    parser.len = len;
+    parser.line = header_end != NULL ? (size_t) (header_end - data) + 1 : len;
+    parser.indexed = parser.line;
+    parser.base = parser.line;
+    parser.separators.resize(parser_block_size + 1);
+    parser.count = 0;
+    parser.next = 0;
+    parser.skipped = 0;
+}
+
+//Value of two digits; bad is set when one of them is not a digit
+static inline int two_digits(const char* p, unsigned* bad) {
+    unsigned high = (unsigned) (p[0] - '0');
+    unsigned low = (unsigned) (p[1] - '0');
+    *bad |= (unsigned) (high > 9) | (unsigned) (low > 9);
+    return (int) (high * 10 + low);
+}
+
+bool parse_timestamp(const char* p, size_t len, int64_t* local_seconds) {
+    if (len != 16 && len != 19) {
+        return false;
+    }
+    //Fixed positions of yyyy-MM-dd HH:mm[:ss]
+    unsigned bad = 0;
+    int year = two_digits(p, &bad) * 100 + two_digits(p + 2, &bad);
+    int month = two_digits(p + 5, &bad);
+    int day = two_digits(p + 8, &bad);
+    int hour = two_digits(p + 11, &bad);
+    int minute = two_digits(p + 14, &bad);
+    int second = 0;
+    if (len == 19) {
+        second = two_digits(p + 17, &bad);
+        bad |= p[16] != ':';
+    }
+    bad |= p[4] != '-' || p[7] != '-' || (p[10] != ' ' && p[10] != 'T') || p[13] != ':';
+    if (bad || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 59) {
+        return false;
+    }
+    *local_seconds = (int64_t) days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+static const float powers_of_ten[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+bool parse_float(const char* p, size_t len, float* value) {
+    const char* end = p + len;
+    const char* q = p;
+    bool negative = q < end && *q == '-';
+    if (q < end && (*q == '-' || *q == '+')) {
+        q++;
+    }
+    //At most 7 digits and a dot
+    const char* digits_start = q;
+    const char* fraction_start = NULL;
+    const char* fast_end = end - q > 8 ? q + 8 : end;
+    uint32_t mantissa = 0;
+    for (; q < fast_end; q++) {
+        unsigned d = (unsigned) (*q - '0');
+        if (d < 10) {
+            mantissa = mantissa * 10 + d;
+        } else if (*q == '.' && fraction_start == NULL) {
+            fraction_start = q + 1;
+        } else {
+            break;
+        }
+    }
+    long digits = (q - digits_start) - (fraction_start != NULL);
+    //Exact mantissa (< 2^24) and power of ten in float: one division is correctly rounded
+    if (q == end && digits > 0 && digits <= 7) {
+        float result = fraction_start != NULL ? (float) mantissa / powers_of_ten[end - fraction_start] : (float) mantissa;
+        *value = negative ? -result : result;
+        return true;
+    }
+    //Long or unusual numbers (exponents, many digits) go to strtof
+    std::string text(p, len);
+    char* stop;
+    *value = strtof(text.c_str(), &stop);
+    return len > 0 && stop == text.c_str() + len;
+}
+
+//Whether the separator at the offset ends a line
+static inline bool parser_line_end(const reading_parser& parser, uint32_t separator) {
+    size_t pos = parser.base + separator;
+    return pos == parser.len || parser.data[pos] == '\n';
+}
+
+bool parser_next(reading_parser& parser, sensor_row& row) {
+    while (true) {
+        while (parser.count - parser.next < 4 && parser.indexed < parser.len) {
+            parser_refill(parser);
+        }
+        size_t available = parser.count - parser.next;
+        if (available == 0) {
+            return false;
+        }
+        const uint32_t* s = &parser.separators[parser.next];
+        const char* base = parser.data + parser.base;
+        const char* line = parser.data + parser.line;
+        //A valid line has 3 ';' and then its end
+        if (available >= 4 && !parser_line_end(parser, s[0]) && !parser_line_end(parser, s[1]) &&
+            !parser_line_end(parser, s[2]) && parser_line_end(parser, s[3])) {
+            const char* f1 = base + s[0] + 1;
+            const char* f2 = base + s[1] + 1;
+            const char* f3 = base + s[2] + 1;
+            const char* line_end = base + s[3];
+            const char* humidity_end = line_end > f3 && line_end[-1] == '\r' ? line_end - 1 : line_end;
+            parser.next += 4;
+            parser.line = parser.base + s[3] + 1;
+            row.location = line;
+            row.location_len = (uint32_t) (base + s[0] - line);
+            if (parse_timestamp(f1, (size_t) (base + s[1] - f1), &row.local_seconds) &&
+                parse_float(f2, (size_t) (base + s[2] - f2), &row.temperature) &&
+                parse_float(f3, (size_t) (humidity_end - f3), &row.humidity)) {
+                return true;
+            }
+            parser.skipped++;
+            continue;
+        }
+        //Malformed line: skip it up to its new line
+        size_t i = parser.next;
+        while (true) {
+            while (i < parser.count && !parser_line_end(parser, parser.separators[i])) {
+                i++;
+            }
+            if (i < parser.count || parser.indexed == parser.len) {
+                break;
+            }
+            //The line continues in the next block
+            parser.next = i;
+            parser_refill(parser);
+            i = 0;
+        }
+        parser.skipped++;
+        if (i < parser.count) {
+            parser.line = parser.base + parser.separators[i] + 1;
+            parser.next = i + 1;
+        } else {
+            parser.line = parser.len;
+            parser.next = i;
+        }
+    }
+}
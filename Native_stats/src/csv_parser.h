@@ -0,0 +1,69 @@
+#ifndef CSV_PARSER_H
+#define CSV_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Parser of the sensor readings Location;Date Time;Temperature;Humidity, both with the
+//timestamps of DataOut/dataset.csv (2020-04-01 00:08:00) and with the ones of the
+//Node-RED DB.csv (2022-09-03 15:01). The text is never copied: the file is memory-mapped
+//and the locations of the rows point into it.
+
+//File mapped in memory (or read, when it cannot be mapped)
+struct mapped_file {
+    const char* data;
+    size_t len;
+    bool mapped;
+};
+
+bool map_file(const char* path, mapped_file& file);
+void unmap_file(mapped_file& file);
+
+//One row; location is not terminated and lives as long as the mapped file
+struct sensor_row {
+    const char* location;
+    uint32_t location_len;
+    int64_t local_seconds;
+    float temperature;
+    float humidity;
+};
+
+//The separators (';' and '\n') are found with SSE2/AVX2 in blocks of parser_block_size
+//bytes and their offsets are kept in an index that the rows are parsed from
+#define parser_block_size (64 * 1024)
+
+struct reading_parser {
+    const char* data;
+    size_t len;
+    //Bytes of the data already indexed
+    size_t indexed;
+    //Offsets of the separators not parsed yet (next to count), relative to base
+    std::vector<uint32_t> separators;
+    size_t count;
+    size_t next;
+    size_t base;
+    //Start of the next line
+    size_t line;
+    size_t skipped;
+};
+
+//Start parsing the text; the first line is the header and it is skipped
+void parser_init(reading_parser& parser, const char* data, size_t len);
+
+//Parse the next valid row; returns false at the end of the text.
+//Malformed lines are skipped and counted in parser.skipped.
+bool parser_next(reading_parser& parser, sensor_row& row);
+
+//Write to positions offset plus the index of every ';' and '\n' in [data, data + len)
+//and return how many they are; positions must have room for len values
+size_t find_separators(const char* data, size_t len, uint32_t offset, uint32_t* positions);
+
+//yyyy-MM-dd HH:mm[:ss] (or with a 'T') as seconds since the epoch, as if it was UTC
+bool parse_timestamp(const char* p, size_t len, int64_t* local_seconds);
+
+//Decimal number as float, without strtof when it has at most 7 digits (the
+//result is the same correctly rounded float)
+bool parse_float(const char* p, size_t len, float* value);
+
+#endif
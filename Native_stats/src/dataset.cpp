@@ -0,0 +1,73 @@
+#include "dataset.h"
+#include "csv_parser.h"
+#include "rome_time.h"
+#include "snapshot.h"
+
+#include <string_view>
+
+//From the ids in the order the codes were seen to the packed keys
+static bool pack_rooms(dataset& data) {
+    if (!location_pack(data.locations)) {
+        return false;
+    }
+    for (uint32_t& room : data.room) {
+        room = data.locations.packed[room];
+    }
+    return true;
+}
+
+static void add_row(dataset& data, uint32_t room, int64_t epoch, float temperature, float humidity) {
+    int64_t local = epoch + rome_offset(epoch);
+    data.room.push_back(room);
+    data.epoch.push_back(epoch);
+    data.day.push_back((int32_t) (local / 86400));
+    data.hour.push_back((uint8_t) (local % 86400 / 3600));
+    data.temperature.push_back(temperature);
+    data.humidity.push_back(humidity);
+}
+
+//The rows of a snapshot are copied from the mapping: nothing is parsed, only the seconds,
+//the day and the hour of every reading are computed
+static bool load_snapshot(const char* path, dataset& data) {
+    snapshot_view view;
+    if (!open_snapshot(path, view)) {
+        return false;
+    }
+    for (size_t l = 0; l < view.n_locations; l++) {
+        const char* code = view.location_text + view.location_offsets[l];
+        location_intern(data.locations, std::string_view(code, view.location_offsets[l + 1] - view.location_offsets[l]));
+    }
+    bool valid = data.locations.codes.size() == view.n_locations;
+    data.room.reserve(view.rows);
+    data.epoch.reserve(view.rows);
+    data.day.reserve(view.rows);
+    data.hour.reserve(view.rows);
+    data.temperature.reserve(view.rows);
+    data.humidity.reserve(view.rows);
+    for (size_t i = 0; i < view.rows && valid; i++) {
+        valid = view.location_id[i] < view.n_locations;
+        add_row(data, view.location_id[i], (int64_t) view.epoch_minute[i] * 60, view.temperature[i], view.humidity[i]);
+    }
+    close_snapshot(view);
+    return valid && pack_rooms(data);
+}
+
+bool load_dataset(const char* path, dataset& data) {
+    if (is_snapshot(path)) {
+        return load_snapshot(path, data);
+    }
+    mapped_file file;
+    if (!map_file(path, file)) {
+        return false;
+    }
+    reading_parser parser;
+    parser_init(parser, file.data, file.len);
+    sensor_row row;
+    while (parser_next(parser, row)) {
+        add_row(data, location_intern(data.locations, std::string_view(row.location, row.location_len)),
+                rome_to_epoch(row.local_seconds), row.temperature, row.humidity);
+    }
+    data.skipped = parser.skipped;
+    unmap_file(file);
+    return pack_rooms(data);
+}
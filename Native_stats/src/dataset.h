@@ -0,0 +1,38 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include "location_dictionary.h"
+
+#include <cstdint>
+#include <vector>
+
+//Sensor readings stored by column; row i of every column is line i of the CSV.
+//The location of a row is the packed key of its room; times are UTC seconds, day and
+//hour are the local (Europe/Rome) ones used by Stats.java.
+struct dataset {
+    std::vector<uint32_t> room;
+    std::vector<int64_t> epoch;
+    std::vector<int32_t> day;
+    std::vector<uint8_t> hour;
+    std::vector<float> temperature;
+    std::vector<float> humidity;
+    location_dictionary locations;
+    //Malformed lines of the file
+    size_t skipped = 0;
+
+    size_t size() const {
+        return epoch.size();
+    }
+
+    //Key of the location of the row at the given level
+    uint32_t location(int level, size_t row) const {
+        return locations.key(level, room[row]);
+    }
+};
+
+//Load a Location;Date Time;Temperature;Humidity file (header included) or a snapshot
+//written by make_snapshot (src/snapshot.h). Returns false if the file cannot be read or it has too many locations for the
+//packed keys; malformed lines are skipped.
+bool load_dataset(const char* path, dataset& data);
+
+#endif
@@ -0,0 +1,148 @@
+#include "location_dictionary.h"
+
+#include <algorithm>
+
+uint32_t location_intern(location_dictionary& dictionary, std::string_view code) {
+    auto found = dictionary.ids.find(code);
+    if (found != dictionary.ids.end()) {
+        return found->second;
+    }
+    uint32_t id = (uint32_t) dictionary.codes.size();
+    dictionary.codes.emplace_back(code);
+    dictionary.ids.emplace(std::string_view(dictionary.codes.back()), id);
+    return id;
+}
+
+//Parts of a code: N, B and F end at the first three dots, the room is the rest.
+//As split(...).getItem(i) in Stats.java, a code with fewer dots has missing parts.
+struct location_parts {
+    std::string_view part[level_count];
+    int n_parts;
+    uint32_t id;
+};
+
+static location_parts split_code(const std::string& code, uint32_t id) {
+    location_parts parts;
+    parts.n_parts = 0;
+    parts.id = id;
+    size_t start = 0;
+    while (parts.n_parts < level_count - 1) {
+        size_t dot = code.find('.', start);
+        if (dot == std::string::npos) {
+            break;
+        }
+        parts.part[parts.n_parts++] = std::string_view(code).substr(start, dot - start);
+        start = dot + 1;
+    }
+    parts.part[parts.n_parts++] = std::string_view(code).substr(start);
+    return parts;
+}
+
+//Order of the parts from the neighborhood down; a missing part comes first
+static bool parts_less(const location_parts& a, const location_parts& b) {
+    for (int i = 0; i < level_count; i++) {
+        bool a_has = i < a.n_parts;
+        bool b_has = i < b.n_parts;
+        if (a_has != b_has) {
+            return b_has;
+        }
+        if (a_has && a.part[i] != b.part[i]) {
+            return a.part[i] < b.part[i];
+        }
+    }
+    return false;
+}
+
+static bool same_part(const location_parts& a, const location_parts& b, int i) {
+    bool a_has = i < a.n_parts;
+    bool b_has = i < b.n_parts;
+    return a_has == b_has && (!a_has || a.part[i] == b.part[i]);
+}
+
+static int bits_for(uint32_t count) {
+    int bits = 0;
+    while (((uint32_t) 1 << bits) < count) {
+        bits++;
+    }
+    return bits;
+}
+
+//Name of the location of the level: its parts joined by dots (concat_ws skips the
+//missing ones); a room keeps its whole code
+static std::string level_name(const location_parts& parts, const std::string& code, int level) {
+    if (level == level_room) {
+        return code;
+    }
+    std::string name;
+    for (int i = 0; i < level_count - level && i < parts.n_parts; i++) {
+        if (i > 0) {
+            name += '.';
+        }
+        name.append(parts.part[i]);
+    }
+    return name;
+}
+
+bool location_pack(location_dictionary& dictionary) {
+    std::vector<location_parts> all;
+    for (uint32_t id = 0; id < dictionary.codes.size(); id++) {
+        all.push_back(split_code(dictionary.codes[id], id));
+    }
+    std::sort(all.begin(), all.end(), parts_less);
+
+    //Index of every part among its siblings: part i of the code (0 = neighborhood)
+    //is stored in the field of level level_count - 1 - i
+    std::vector<uint32_t> indexes(all.size() * level_count);
+    uint32_t most[level_count] = {0, 0, 0, 0};
+    uint32_t current[level_count] = {0, 0, 0, 0};
+    for (size_t c = 0; c < all.size(); c++) {
+        //First part that differs from the previous code
+        int changed = 0;
+        if (c > 0) {
+            while (changed < level_count && same_part(all[c], all[c - 1], changed)) {
+                changed++;
+            }
+        }
+        for (int i = changed; i < level_count; i++) {
+            current[i] = c == 0 || i > changed ? 0 : current[i] + 1;
+        }
+        for (int i = 0; i < level_count; i++) {
+            indexes[c * level_count + i] = current[i];
+            most[i] = std::max(most[i], current[i] + 1);
+        }
+    }
+
+    int shift = 0;
+    for (int level = 0; level < level_count; level++) {
+        dictionary.widths[level] = bits_for(most[level_count - 1 - level]);
+        dictionary.shifts[level] = shift;
+        shift += dictionary.widths[level];
+    }
+    if (shift > location_max_bits) {
+        return false;
+    }
+
+    dictionary.packed.assign(dictionary.codes.size(), 0);
+    for (int level = 0; level < level_count; level++) {
+        dictionary.names[level].assign(dictionary.slots(level), std::string());
+    }
+    for (size_t c = 0; c < all.size(); c++) {
+        uint32_t key = 0;
+        for (int level = 0; level < level_count; level++) {
+            key |= indexes[c * level_count + level_count - 1 - level] << dictionary.shifts[level];
+        }
+        dictionary.packed[all[c].id] = key;
+        const std::string& code = dictionary.codes[all[c].id];
+        for (int level = 0; level < level_count; level++) {
+            std::string& name = dictionary.names[level][dictionary.key(level, key)];
+            if (name.empty()) {
+                name = level_name(all[c], code, level);
+            }
+        }
+    }
+    return true;
+}
+
+std::string location_name(const std::string& code, int level) {
+    return level_name(split_code(code, 0), code, level);
+}
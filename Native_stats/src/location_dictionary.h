@@ -0,0 +1,69 @@
+#ifndef LOCATION_DICTIONARY_H
+#define LOCATION_DICTIONARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//Levels of the location hierarchy N.B.F.R
+enum location_level {
+    level_room = 0,
+    level_floor = 1,
+    level_building = 2,
+    level_neighborhood = 3,
+    level_count = 4
+};
+
+//Largest number of bits of a packed room key: the arrays indexed by the keys of a
+//level have 2^bits slots
+#define location_max_bits 24
+
+//Dictionary of the locations N.B.F.R. Every code is interned once and then packed in
+//an integer made of bit fields, neighborhood | building | floor | room, where every
+//field is the index of the part among the ones with the same parent, in name order
+//(so the order of the keys is the order of the names). The key of a parent is the key
+//of the room shifted right: floor, building and neighborhood keys are small integers
+//that index arrays directly.
+struct location_dictionary {
+    //Bits of the part of every level and shift from a room key to the key of the level
+    int widths[level_count];
+    int shifts[level_count];
+    //Name of every key of every level (empty for the keys not used)
+    std::vector<std::string> names[level_count];
+
+    //Codes interned while parsing (a deque, so that the views of ids stay valid)
+    //and their packed keys (filled by location_pack)
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::deque<std::string> codes;
+    std::vector<uint32_t> packed;
+
+    //Key of the location at the level from the key of the room
+    uint32_t key(int level, uint32_t room_key) const {
+        return room_key >> shifts[level];
+    }
+
+    //Number of keys (used or not) of the level
+    size_t slots(int level) const {
+        return (size_t) 1 << (shifts[level_neighborhood] + widths[level_neighborhood] - shifts[level]);
+    }
+
+    const std::string& name(int level, uint32_t key) const {
+        return names[level][key];
+    }
+};
+
+//Id of the code in the order it was first seen (its packed key is known after location_pack)
+uint32_t location_intern(location_dictionary& dictionary, std::string_view code);
+
+//Give every interned code its packed key and build the names of all the levels.
+//Returns false if the keys would need more than location_max_bits bits.
+bool location_pack(location_dictionary& dictionary);
+
+//Name of the location of the level that contains the room with the code
+std::string location_name(const std::string& code, int level);
+
+#endif
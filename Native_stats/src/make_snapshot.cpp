@@ -0,0 +1,23 @@
+//Converter from a CSV of readings (Location;Date Time;Temperature;Humidity) to a binary
+//columnar snapshot (src/snapshot.h), which native_stats --input loads without parsing
+#include "snapshot.h"
+
+#include <cstdio>
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <csv> <snapshot>\n", argv[0]);
+        return 1;
+    }
+    if (!write_snapshot(argv[1], argv[2])) {
+        return 1;
+    }
+    snapshot_view view;
+    if (!open_snapshot(argv[2], view)) {
+        fprintf(stderr, "Cannot read back %s\n", argv[2]);
+        return 1;
+    }
+    printf("Rows: %zu, locations: %zu, bytes: %zu\n", view.rows, view.n_locations, view.len);
+    close_snapshot(view);
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include "rollup.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+
+static const location_day empty_cell = {0, {{0, 0, 0, 0}, {0, 0, 0, 0}}, {{0, 0, 0, 0}, {0, 0, 0, 0}}};
+
+//Rooms of every day of a partition: its rows (in the order of the file) are taken day by
+//day (counting sort, stable) and summed in an array indexed by the bits of the room key
+//below the key of the partition
+static void build_rooms(const dataset& data, const uint32_t* rows, size_t n_rows, size_t n_days, uint32_t room_mask,
+                        day_rollup& rollup) {
+    std::vector<uint32_t> row_start(n_days + 1, 0);
+    for (size_t j = 0; j < n_rows; j++) {
+        row_start[data.day[rows[j]] - rollup.first_day + 1]++;
+    }
+    for (size_t d = 1; d <= n_days; d++) {
+        row_start[d] += row_start[d - 1];
+    }
+    std::vector<uint32_t> by_day(n_rows);
+    std::vector<uint32_t> fill(row_start.begin(), row_start.end() - 1);
+    for (size_t j = 0; j < n_rows; j++) {
+        by_day[fill[data.day[rows[j]] - rollup.first_day]++] = rows[j];
+    }
+
+    std::vector<location_day> rooms((size_t) room_mask + 1, empty_cell);
+    std::vector<uint32_t> touched;
+    std::vector<uint32_t>& day_start = rollup.day_start[level_room];
+    std::vector<location_day>& cells = rollup.cells[level_room];
+    day_start.assign(1, 0);
+    for (size_t d = 0; d < n_days; d++) {
+        touched.clear();
+        for (uint32_t j = row_start[d]; j < row_start[d + 1]; j++) {
+            uint32_t i = by_day[j];
+            location_day& room = rooms[data.room[i] & room_mask];
+            if (room.temperature[0].count == 0 && room.temperature[1].count == 0) {
+                touched.push_back(data.room[i]);
+            }
+            int daily = data.hour[i] >= 8 && data.hour[i] < 20;
+            partial_add(room.temperature[daily], data.temperature[i]);
+            partial_add(room.humidity[daily], data.humidity[i]);
+        }
+        std::sort(touched.begin(), touched.end());
+        for (uint32_t key : touched) {
+            location_day& room = rooms[key & room_mask];
+            room.location = key;
+            cells.push_back(room);
+            room = empty_cell;
+        }
+        day_start.push_back((uint32_t) cells.size());
+    }
+}
+
+//Merge the cells of the level below that have the same parent
+static void build_level(const dataset& data, day_rollup& rollup, int level) {
+    const std::vector<uint32_t>& child_start = rollup.day_start[level - 1];
+    const std::vector<location_day>& children = rollup.cells[level - 1];
+    int shift = data.locations.shifts[level] - data.locations.shifts[level - 1];
+    std::vector<uint32_t>& day_start = rollup.day_start[level];
+    std::vector<location_day>& cells = rollup.cells[level];
+    day_start.assign(1, 0);
+    for (size_t d = 0; d + 1 < child_start.size(); d++) {
+        for (uint32_t c = child_start[d]; c < child_start[d + 1]; c++) {
+            uint32_t parent = children[c].location >> shift;
+            if (c == child_start[d] || cells.back().location != parent) {
+                cells.push_back(empty_cell);
+                cells.back().location = parent;
+            }
+            location_day& cell = cells.back();
+            for (int daily = 0; daily < 2; daily++) {
+                partial_merge(cell.temperature[daily], children[c].temperature[daily]);
+                partial_merge(cell.humidity[daily], children[c].humidity[daily]);
+            }
+        }
+        day_start.push_back((uint32_t) cells.size());
+    }
+}
+
+void build_day_rollup(const dataset& data, day_rollup& rollup, int threads) {
+    for (int level = 0; level < level_count; level++) {
+        rollup.day_start[level].clear();
+        rollup.cells[level].clear();
+    }
+    if (data.size() == 0) {
+        return;
+    }
+    rollup.first_day = *std::min_element(data.day.begin(), data.day.end());
+    int32_t last_day = *std::max_element(data.day.begin(), data.day.end());
+    size_t n_days = (size_t) (last_day - rollup.first_day) + 1;
+
+    //Rows by partition (counting sort, stable, so every partition keeps the order of the file)
+    const int top = rollup_partition_level;
+    std::vector<uint32_t> row_start(data.locations.slots(top) + 1, 0);
+    for (size_t i = 0; i < data.size(); i++) {
+        row_start[data.location(top, i) + 1]++;
+    }
+    for (size_t p = 1; p < row_start.size(); p++) {
+        row_start[p] += row_start[p - 1];
+    }
+    std::vector<uint32_t> rows(data.size());
+    std::vector<uint32_t> fill(row_start.begin(), row_start.end() - 1);
+    for (uint32_t i = 0; i < data.size(); i++) {
+        rows[fill[data.location(top, i)]++] = i;
+    }
+    std::vector<uint32_t> keys;
+    for (uint32_t key = 0; key + 1 < row_start.size(); key++) {
+        if (row_start[key + 1] > row_start[key]) {
+            keys.push_back(key);
+        }
+    }
+
+    //Every partition builds its levels up to the one of the partition; the biggest start first
+    std::vector<day_rollup> parts(keys.size());
+    std::vector<size_t> by_size(keys.size());
+    for (size_t p = 0; p < keys.size(); p++) {
+        by_size[p] = p;
+    }
+    std::stable_sort(by_size.begin(), by_size.end(), [&](size_t a, size_t b) {
+        return row_start[keys[a] + 1] - row_start[keys[a]] > row_start[keys[b] + 1] - row_start[keys[b]];
+    });
+    uint32_t room_mask = (uint32_t) ((1ULL << data.locations.shifts[top]) - 1);
+    run_tasks(threads, keys.size(), [&](size_t task) {
+        size_t p = by_size[task];
+        day_rollup& part = parts[p];
+        part.first_day = rollup.first_day;
+        build_rooms(data, &rows[row_start[keys[p]]], row_start[keys[p] + 1] - row_start[keys[p]], n_days, room_mask, part);
+        for (int level = level_floor; level <= top; level++) {
+            build_level(data, part, level);
+        }
+    });
+
+    //The cells of a day are the ones of the partitions in key order
+    for (int level = 0; level <= top; level++) {
+        std::vector<uint32_t>& day_start = rollup.day_start[level];
+        std::vector<location_day>& cells = rollup.cells[level];
+        size_t total = 0;
+        for (const day_rollup& part : parts) {
+            total += part.cells[level].size();
+        }
+        cells.reserve(total);
+        day_start.assign(1, 0);
+        for (size_t d = 0; d < n_days; d++) {
+            for (const day_rollup& part : parts) {
+                const std::vector<uint32_t>& part_start = part.day_start[level];
+                cells.insert(cells.end(), part.cells[level].begin() + part_start[d],
+                             part.cells[level].begin() + part_start[d + 1]);
+            }
+            day_start.push_back((uint32_t) cells.size());
+        }
+    }
+    for (int level = top + 1; level < level_count; level++) {
+        build_level(data, rollup, level);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include "dataset.h"
+
+#include <cstdint>
+#include <vector>
+
+//Partial aggregate of a group of readings
+struct partial {
+    double sum;
+    long long count;
+    float min;
+    float max;
+};
+
+inline void partial_add(partial& into, float value) {
+    if (into.count == 0 || value < into.min) {
+        into.min = value;
+    }
+    if (into.count == 0 || value > into.max) {
+        into.max = value;
+    }
+    into.sum += (double) value;
+    into.count++;
+}
+
+inline void partial_merge(partial& into, const partial& from) {
+    if (from.count == 0) {
+        return;
+    }
+    if (into.count == 0 || from.min < into.min) {
+        into.min = from.min;
+    }
+    if (into.count == 0 || from.max > into.max) {
+        into.max = from.max;
+    }
+    into.sum += from.sum;
+    into.count += from.count;
+}
+
+//Aggregates of one location in one day: index 0 is the night (before 8 and from 20),
+//index 1 the day time
+struct location_day {
+    uint32_t location;
+    partial temperature[2];
+    partial humidity[2];
+};
+
+//Aggregates of every location of every level, day by day. The readings are scanned
+//once to build the ones of the rooms; as the rooms of a day are sorted by key, the
+//rooms of a floor (and the floors of a building, ...) are contiguous and every level
+//is built by merging the partials of the level below.
+//The rows are partitioned by the location of rollup_partition_level: every partition
+//builds the levels up to that one for all the days on its own, as a task of a work-stealing
+//pool, with no data shared with the others; the cells of the partitions are then
+//concatenated day by day in key order and the levels above are merged from them.
+struct day_rollup {
+    int32_t first_day;
+    //Cells of day first_day + d of a level are [day_start[level][d], day_start[level][d + 1])
+    std::vector<uint32_t> day_start[level_count];
+    std::vector<location_day> cells[level_count];
+
+    size_t days() const {
+        return day_start[0].empty() ? 0 : day_start[0].size() - 1;
+    }
+};
+
+#define rollup_partition_level level_building
+
+//Build the roll-up on the given number of threads
+void build_day_rollup(const dataset& data, day_rollup& rollup, int threads);
+
+#endif
@@ -0,0 +1,101 @@
+#include "rome_time.h"
+
+//Algorithms of http://howardhinnant.github.io/date_algorithms.html
+int32_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yoe = (unsigned) (year - era * 400);
+    const unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t) doe - 719468;
+}
+
+void civil_from_days(int32_t days, int* year, int* month, int* day) {
+    days += 719468;
+    const int era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned doe = (unsigned) (days - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    *day = (int) (doy - (153 * mp + 2) / 5 + 1);
+    *month = (int) (mp < 10 ? mp + 3 : mp - 9);
+    *year = (int) yoe + era * 400 + (*month <= 2);
+}
+
+//Days since the epoch of the last Sunday of the month
+static int32_t last_sunday(int year, int month) {
+    int32_t last = days_from_civil(year, month + 1, 1) - 1;
+    //1970-01-01 was a Thursday
+    int weekday = (int) ((last % 7 + 7 + 4) % 7);
+    return last - weekday;
+}
+
+bool rome_is_summer(int64_t epoch) {
+    int32_t days = (int32_t) (epoch >= 0 ? epoch / 86400 : (epoch - 86399) / 86400);
+    int year, month, day;
+    civil_from_days(days, &year, &month, &day);
+    if (month < 3 || month > 10) {
+        return false;
+    }
+    int64_t start = (int64_t) last_sunday(year, 3) * 86400 + 3600;
+    int64_t end = (int64_t) last_sunday(year, 10) * 86400 + 3600;
+    return epoch >= start && epoch < end;
+}
+
+int64_t rome_to_epoch(int64_t local_seconds) {
+    int64_t summer = local_seconds - 7200;
+    if (rome_is_summer(summer)) {
+        return summer;
+    }
+    //Winter time, or the spring gap moved forward by one hour
+    return local_seconds - 3600;
+}
+
+int64_t rome_minus_days(int64_t epoch, int days) {
+    int offset = rome_offset(epoch);
+    int64_t local = epoch + offset - (int64_t) days * 86400;
+    int64_t same_offset = local - offset;
+    if (rome_offset(same_offset) == offset) {
+        return same_offset;
+    }
+    return rome_to_epoch(local);
+}
+
+static inline void write_digits(char* out, int value, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        out[i] = (char) ('0' + value % 10);
+        value /= 10;
+    }
+}
+
+void format_date(int32_t days, char* out) {
+    int year, month, day;
+    civil_from_days(days, &year, &month, &day);
+    write_digits(out, year, 4);
+    out[4] = '-';
+    write_digits(&out[5], month, 2);
+    out[7] = '-';
+    write_digits(&out[8], day, 2);
+}
+
+void format_timestamp(int64_t epoch, char* out) {
+    int offset = rome_offset(epoch);
+    int64_t local = epoch + offset;
+    int32_t days = (int32_t) (local >= 0 ? local / 86400 : (local - 86399) / 86400);
+    int seconds = (int) (local - (int64_t) days * 86400);
+    format_date(days, out);
+    out[10] = 'T';
+    write_digits(&out[11], seconds / 3600, 2);
+    out[13] = ':';
+    write_digits(&out[14], seconds / 60 % 60, 2);
+    out[16] = ':';
+    write_digits(&out[17], seconds % 60, 2);
+    out[19] = '.';
+    out[20] = '0';
+    out[21] = '0';
+    out[22] = '0';
+    out[23] = '+';
+    write_digits(&out[24], offset / 3600, 2);
+    out[26] = ':';
+    write_digits(&out[27], offset / 60 % 60, 2);
+}
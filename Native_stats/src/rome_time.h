@@ -0,0 +1,41 @@
+#ifndef ROME_TIME_H
+#define ROME_TIME_H
+
+#include <cstdint>
+
+//The Spark job runs in the Europe/Rome time zone (CET, +01:00, and CEST, +02:00,
+//from the last Sunday of March to the last Sunday of October at 01:00 UTC), so the
+//readings are interpreted and printed in that zone.
+
+//Days since 1970-01-01 of a civil date
+int32_t days_from_civil(int year, int month, int day);
+
+//Civil date of a number of days since 1970-01-01
+void civil_from_days(int32_t days, int* year, int* month, int* day);
+
+//Whether CEST is in force at the UTC instant
+bool rome_is_summer(int64_t epoch);
+
+//UTC instant of a local Rome date-time (seconds since the epoch, as if it was UTC).
+//Like java.time, a time in the spring gap is moved forward by one hour and a time in
+//the autumn overlap takes the summer (earlier) offset.
+int64_t rome_to_epoch(int64_t local_seconds);
+
+//Offset from UTC, in seconds, at the UTC instant
+inline int rome_offset(int64_t epoch) {
+    return rome_is_summer(epoch) ? 7200 : 3600;
+}
+
+//The instant a number of calendar days before: like ZonedDateTime.minusDays the local
+//date-time moves and keeps its offset when it is still valid, so across a change of
+//time the result is 23 or 25 hours away
+int64_t rome_minus_days(int64_t epoch, int days);
+
+//Write the instant in the format of the Spark CSV writer, e.g. 2020-04-04T07:50:00.000+02:00
+//(29 characters, no terminator)
+void format_timestamp(int64_t epoch, char* out);
+
+//Write the date as yyyy-MM-dd (10 characters, no terminator)
+void format_date(int32_t days, char* out);
+
+#endif
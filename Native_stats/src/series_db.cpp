@@ -0,0 +1,213 @@
+//Command line of the compressed time-series store (src/series_store.cpp):
+//  series_db append <store> <csv|->     add the readings of a CSV (e.g. the new lines of DB.csv)
+//  series_db query <store> [--location <name>] [--from <time>] [--to <time>] [--bench]
+//                                       print the readings as Location;Date Time;Temperature;Humidity
+//  series_db info <store>               print the size of the store
+//  series_db compact <store>            rewrite the store with full chunks
+//A location is a room code or the name of a floor, building or neighborhood (e.g. A.0);
+//the times are local (Europe/Rome) yyyy-MM-dd HH:mm[:ss].
+#include "csv_parser.h"
+#include "location_dictionary.h"
+#include "rome_time.h"
+#include "series_store.h"
+
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+
+static int usage(const char* program) {
+    fprintf(stderr, "Usage: %s append <store> <csv|->\n"
+                    "       %s query <store> [--location <name>] [--from <time>] [--to <time>] [--bench]\n"
+                    "       %s info <store>\n"
+                    "       %s compact <store>\n", program, program, program, program);
+    return 1;
+}
+
+static bool open_store(const char* path, series_store& store) {
+    if (!store_open(path, store)) {
+        fprintf(stderr, "%s is not a store\n", path);
+        return false;
+    }
+    return true;
+}
+
+static int append(const char* path, const char* input) {
+    series_store store;
+    if (!open_store(path, store)) {
+        return 1;
+    }
+    mapped_file file;
+    if (!map_file(strcmp(input, "-") == 0 ? "/dev/stdin" : input, file)) {
+        fprintf(stderr, "Cannot read %s\n", input);
+        return 1;
+    }
+    series_batch batch;
+    reading_parser parser;
+    parser_init(parser, file.data, file.len);
+    sensor_row row;
+    size_t rows = 0;
+    while (parser_next(parser, row)) {
+        batch[std::string(row.location, row.location_len)].push_back(
+                series_reading{rome_to_epoch(row.local_seconds), row.temperature, row.humidity});
+        rows++;
+    }
+    unmap_file(file);
+    if (!store_append(store, batch)) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return 1;
+    }
+    fprintf(stderr, "Appended %zu readings (%zu lines skipped)\n", rows, parser.skipped);
+    return 0;
+}
+
+static bool parse_time(const char* text, int64_t* epoch) {
+    int64_t local_seconds;
+    if (!parse_timestamp(text, strlen(text), &local_seconds)) {
+        fprintf(stderr, "Invalid time %s\n", text);
+        return false;
+    }
+    *epoch = rome_to_epoch(local_seconds);
+    return true;
+}
+
+static int query(const char* path, int argc, char** argv) {
+    const char* location = NULL;
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    bool benchmark = false;
+    for (int a = 0; a < argc; a++) {
+        if (strcmp(argv[a], "--location") == 0 && a + 1 < argc) {
+            location = argv[++a];
+        } else if (strcmp(argv[a], "--from") == 0 && a + 1 < argc) {
+            if (!parse_time(argv[++a], &from)) {
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--to") == 0 && a + 1 < argc) {
+            if (!parse_time(argv[++a], &to)) {
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--bench") == 0) {
+            benchmark = true;
+        } else {
+            return usage("series_db");
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    series_store store;
+    if (!open_store(path, store)) {
+        return 1;
+    }
+    //The rooms asked for: the one with the name or the ones inside the location
+    std::vector<bool> wanted(store.locations.size(), location == NULL);
+    for (size_t l = 0; location != NULL && l < store.locations.size(); l++) {
+        for (int level = 0; level < level_count; level++) {
+            if (location_name(store.locations[l], level) == location) {
+                wanted[l] = true;
+            }
+        }
+    }
+    std::vector<std::pair<uint32_t, series_reading>> readings;
+    query_stats stats;
+    if (!store_query(store, wanted, from, to, readings, stats)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+    double query_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::string text = "Location;Date Time;Temperature;Humidity\n";
+    char time[29];
+    char number[32];
+    for (const auto& reading : readings) {
+        text += store.locations[reading.first];
+        text += ';';
+        format_timestamp(reading.second.epoch, time);
+        time[10] = ' ';
+        text.append(time, 19);
+        text += ';';
+        text.append(number, std::to_chars(number, number + sizeof(number), reading.second.temperature).ptr);
+        text += ';';
+        text.append(number, std::to_chars(number, number + sizeof(number), reading.second.humidity).ptr);
+        text += '\n';
+    }
+    fwrite(text.data(), 1, text.size(), stdout);
+    if (benchmark) {
+        fprintf(stderr, "Readings: %zu, chunks read: %zu of %zu, bytes read: %zu, time (ms): %.3f\n",
+                readings.size(), stats.chunks_read, store.chunks.size(), stats.bytes_read, query_time);
+    }
+    return 0;
+}
+
+static int info(const char* path) {
+    series_store store;
+    if (!open_store(path, store)) {
+        return 1;
+    }
+    size_t readings = 0;
+    size_t decimal = 0;
+    unsigned long long chunk_bytes = 0;
+    for (const chunk_entry& entry : store.chunks) {
+        readings += entry.count;
+        decimal += (entry.flags & chunk_decimal) != 0;
+        chunk_bytes += entry.bytes;
+    }
+    struct stat file;
+    size_t size = stat(path, &file) == 0 ? (size_t) file.st_size : 0;
+    printf("Locations: %zu, chunks: %zu (%zu with decimal values), readings: %zu\n", store.locations.size(),
+           store.chunks.size(), decimal, readings);
+    unsigned long long used = store_used_bytes(store);
+    printf("Bytes: %zu (chunks %llu, index %llu in %zu records, unused %llu), per reading: %.2f\n", size,
+           chunk_bytes, (unsigned long long) store.index_bytes, store.index_records,
+           (unsigned long long) (size > used ? size - used : 0), readings > 0 ? (double) size / (double) readings : 0.0);
+    //The replaced chunks and the old indexes are dropped by compact
+    if (size > used && size - used > used) {
+        printf("More than half of the file is unused: run compact\n");
+    }
+    return 0;
+}
+
+//Read every reading and write them again, so that the chunks of the small appends are merged
+static int compact(const char* path) {
+    series_store store;
+    if (!open_store(path, store)) {
+        return 1;
+    }
+    std::vector<std::pair<uint32_t, series_reading>> readings;
+    query_stats stats;
+    if (!store_query(store, std::vector<bool>(store.locations.size(), true), INT64_MIN, INT64_MAX, readings, stats)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+    series_batch batch;
+    for (const auto& reading : readings) {
+        batch[store.locations[reading.first]].push_back(reading.second);
+    }
+    std::string temporary = std::string(path) + ".tmp";
+    series_store compacted;
+    remove(temporary.c_str());
+    store_open(temporary.c_str(), compacted);
+    if (!store_append(compacted, batch) || rename(temporary.c_str(), path) != 0) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return 1;
+    }
+    fprintf(stderr, "Chunks: %zu -> %zu\n", store.chunks.size(), compacted.chunks.size());
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        return usage(argv[0]);
+    }
+    if (strcmp(argv[1], "append") == 0 && argc == 4) {
+        return append(argv[2], argv[3]);
+    } else if (strcmp(argv[1], "query") == 0) {
+        return query(argv[2], argc - 3, argv + 3);
+    } else if (strcmp(argv[1], "info") == 0 && argc == 3) {
+        return info(argv[2]);
+    } else if (strcmp(argv[1], "compact") == 0 && argc == 3) {
+        return compact(argv[2]);
+    }
+    return usage(argv[0]);
+}
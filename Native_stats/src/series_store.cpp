@@ -0,0 +1,653 @@
+#include "series_store.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+//Bits written from the most significant one
+struct bit_writer {
+    std::vector<uint8_t>& bytes;
+    uint64_t buffer;
+    int used;
+};
+
+static void put_bits(bit_writer& writer, uint64_t value, int bits) {
+    if (bits > 32) {
+        put_bits(writer, value >> 32, bits - 32);
+        bits = 32;
+    }
+    writer.buffer = (writer.buffer << bits) | (value & ((1ULL << bits) - 1));
+    writer.used += bits;
+    while (writer.used >= 8) {
+        writer.used -= 8;
+        writer.bytes.push_back((uint8_t) (writer.buffer >> writer.used));
+    }
+}
+
+static void flush_bits(bit_writer& writer) {
+    if (writer.used > 0) {
+        writer.bytes.push_back((uint8_t) (writer.buffer << (8 - writer.used)));
+        writer.used = 0;
+    }
+}
+
+struct bit_reader {
+    const uint8_t* data;
+    size_t len;
+    size_t bit;
+};
+
+static uint64_t get_bits(bit_reader& reader, int bits) {
+    uint64_t value = 0;
+    while (bits > 0) {
+        size_t byte = reader.bit >> 3;
+        int offset = (int) (reader.bit & 7);
+        int take = std::min(8 - offset, bits);
+        unsigned int current = byte < reader.len ? reader.data[byte] : 0;
+        value = (value << take) | ((current >> (8 - offset - take)) & ((1U << take) - 1));
+        reader.bit += take;
+        bits -= take;
+    }
+    return value;
+}
+
+//Number of 1 bits before the first 0, at most limit
+static int get_prefix(bit_reader& reader, int limit) {
+    int ones = 0;
+    while (ones < limit && get_bits(reader, 1) == 1) {
+        ones++;
+    }
+    return ones;
+}
+
+//Bits after the prefixes '10', '110', '1110', '11110' ('0' is zero, '11111' is 64 bits)
+static const int time_widths[4] = {7, 9, 12, 20};
+static const int value_widths[4] = {8, 12, 16, 24};
+
+static void put_varying(bit_writer& writer, int64_t value, const int widths[4]) {
+    uint64_t zigzag = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    if (zigzag == 0) {
+        put_bits(writer, 0, 1);
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (zigzag < (1ULL << widths[i])) {
+            //i + 1 ones and a zero
+            put_bits(writer, ((1ULL << (i + 1)) - 1) << 1, i + 2);
+            put_bits(writer, zigzag, widths[i]);
+            return;
+        }
+    }
+    put_bits(writer, 31, 5);
+    put_bits(writer, zigzag, 64);
+}
+
+static int64_t get_varying(bit_reader& reader, const int widths[4]) {
+    int ones = get_prefix(reader, 5);
+    if (ones == 0) {
+        return 0;
+    }
+    uint64_t zigzag = get_bits(reader, ones <= 4 ? widths[ones - 1] : 64);
+    return (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+}
+
+//Hundredths of the value if it is exactly the float of a decimal with 2 digits, as the
+//parser reads it (mantissa / 100)
+static bool to_hundredths(float value, int64_t* hundredths) {
+    if (!std::isfinite(value) || std::fabs(value) >= 80000.0f) {
+        return false;
+    }
+    int64_t rounded = (int64_t) std::llround((double) value * 100.0);
+    float back = (float) rounded / 100.0f;
+    *hundredths = rounded;
+    return memcmp(&back, &value, sizeof(float)) == 0;
+}
+
+static inline uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float bits_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//State of the XOR encoding of a float series (Gorilla)
+struct xor_state {
+    uint32_t previous;
+    int leading;
+    int trailing;
+};
+
+static void put_xor(bit_writer& writer, xor_state& state, float value, bool first) {
+    uint32_t bits = float_bits(value);
+    if (first) {
+        put_bits(writer, bits, 32);
+        state = xor_state{bits, -1, -1};
+        return;
+    }
+    uint32_t x = bits ^ state.previous;
+    state.previous = bits;
+    if (x == 0) {
+        put_bits(writer, 0, 1);
+        return;
+    }
+    int leading = std::min(__builtin_clz(x), 31);
+    int trailing = __builtin_ctz(x);
+    if (state.leading >= 0 && leading >= state.leading && trailing >= state.trailing) {
+        //The meaningful bits are inside the previous window
+        put_bits(writer, 2, 2);
+        put_bits(writer, x >> state.trailing, 32 - state.leading - state.trailing);
+        return;
+    }
+    int meaningful = 32 - leading - trailing;
+    put_bits(writer, 3, 2);
+    put_bits(writer, (uint64_t) leading, 5);
+    put_bits(writer, (uint64_t) (meaningful - 1), 5);
+    put_bits(writer, x >> trailing, meaningful);
+    state.leading = leading;
+    state.trailing = trailing;
+}
+
+static float get_xor(bit_reader& reader, xor_state& state, bool first) {
+    if (first) {
+        state = xor_state{(uint32_t) get_bits(reader, 32), -1, -1};
+        return bits_float(state.previous);
+    }
+    if (get_bits(reader, 1) == 0) {
+        return bits_float(state.previous);
+    }
+    if (get_bits(reader, 1) == 1) {
+        state.leading = (int) get_bits(reader, 5);
+        int meaningful = (int) get_bits(reader, 5) + 1;
+        state.trailing = 32 - state.leading - meaningful;
+    }
+    uint32_t x = (uint32_t) get_bits(reader, 32 - state.leading - state.trailing) << state.trailing;
+    state.previous ^= x;
+    return bits_float(state.previous);
+}
+
+uint32_t encode_chunk(const series_reading* readings, size_t count, std::vector<uint8_t>& bytes) {
+    uint32_t flags = chunk_minutes | chunk_decimal;
+    int64_t hundredths;
+    for (size_t i = 0; i < count; i++) {
+        if (readings[i].epoch % 60 != 0) {
+            flags &= ~chunk_minutes;
+        }
+        if (!to_hundredths(readings[i].temperature, &hundredths) || !to_hundredths(readings[i].humidity, &hundredths)) {
+            flags &= ~chunk_decimal;
+        }
+    }
+    int64_t unit = (flags & chunk_minutes) ? 60 : 1;
+    bit_writer writer = {bytes, 0, 0};
+    int64_t previous_delta = 0;
+    int64_t previous_values[2] = {0, 0};
+    xor_state states[2];
+    for (size_t i = 0; i < count; i++) {
+        //The first timestamp is in the index
+        if (i > 0) {
+            int64_t delta = (readings[i].epoch - readings[i - 1].epoch) / unit;
+            put_varying(writer, delta - previous_delta, time_widths);
+            previous_delta = delta;
+        }
+        float values[2] = {readings[i].temperature, readings[i].humidity};
+        for (int v = 0; v < 2; v++) {
+            if (flags & chunk_decimal) {
+                to_hundredths(values[v], &hundredths);
+                put_varying(writer, hundredths - previous_values[v], value_widths);
+                previous_values[v] = hundredths;
+            } else {
+                put_xor(writer, states[v], values[v], i == 0);
+            }
+        }
+    }
+    flush_bits(writer);
+    return flags;
+}
+
+void decode_chunk(const uint8_t* bytes, size_t len, uint32_t flags, int64_t first, size_t count,
+                  std::vector<series_reading>& out) {
+    int64_t unit = (flags & chunk_minutes) ? 60 : 1;
+    bit_reader reader = {bytes, len, 0};
+    int64_t epoch = first;
+    int64_t delta = 0;
+    int64_t hundredths[2] = {0, 0};
+    xor_state states[2];
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            delta += get_varying(reader, time_widths);
+            epoch += delta * unit;
+        }
+        float values[2];
+        for (int v = 0; v < 2; v++) {
+            if (flags & chunk_decimal) {
+                hundredths[v] += get_varying(reader, value_widths);
+                values[v] = (float) hundredths[v] / 100.0f;
+            } else {
+                values[v] = get_xor(reader, states[v], i == 0);
+            }
+        }
+        out.push_back(series_reading{epoch, values[0], values[1]});
+    }
+}
+
+//Integers of the header, index and trailer are little endian
+static void put_le(std::vector<uint8_t>& bytes, uint64_t value, int len) {
+    for (int i = 0; i < len; i++) {
+        bytes.push_back((uint8_t) (value >> (8 * i)));
+    }
+}
+
+static uint64_t get_le(const uint8_t*& p, int len) {
+    uint64_t value = 0;
+    for (int i = 0; i < len; i++) {
+        value |= (uint64_t) p[i] << (8 * i);
+    }
+    p += len;
+    return value;
+}
+
+#define header_len 16
+#define trailer_len 16
+#define chunk_entry_len 40
+//Length, previous record, first location and number of names
+#define record_header_len 20
+
+//Index record with the names from first_location on and the entries of the slots
+static void put_record(std::vector<uint8_t>& bytes, const series_store& store, uint32_t first_location,
+                       const std::vector<uint32_t>& slots, uint64_t previous) {
+    size_t start = bytes.size();
+    put_le(bytes, 0, 4);
+    put_le(bytes, previous, 8);
+    put_le(bytes, first_location, 4);
+    put_le(bytes, store.locations.size() - first_location, 4);
+    for (size_t l = first_location; l < store.locations.size(); l++) {
+        put_le(bytes, store.locations[l].size(), 2);
+        bytes.insert(bytes.end(), store.locations[l].begin(), store.locations[l].end());
+    }
+    put_le(bytes, slots.size(), 4);
+    for (uint32_t slot : slots) {
+        const chunk_entry& entry = store.chunks[slot];
+        put_le(bytes, slot, 4);
+        put_le(bytes, entry.location, 4);
+        put_le(bytes, entry.count, 4);
+        put_le(bytes, (uint64_t) entry.first, 8);
+        put_le(bytes, (uint64_t) entry.last, 8);
+        put_le(bytes, entry.offset, 8);
+        put_le(bytes, entry.bytes, 4);
+        put_le(bytes, entry.flags, 4);
+    }
+    uint64_t len = bytes.size() - start;
+    for (int i = 0; i < 4; i++) {
+        bytes[start + i] = (uint8_t) (len >> (8 * i));
+    }
+}
+
+//Length of the record of the whole index
+static uint64_t whole_record_len(const series_store& store) {
+    uint64_t len = record_header_len + 4 + (uint64_t) store.chunks.size() * (4 + chunk_entry_len);
+    for (const std::string& name : store.locations) {
+        len += 2 + name.size();
+    }
+    return len;
+}
+
+//Record at offset, which must end by limit (exactly there when exact is set)
+static bool read_record(FILE* file, uint64_t offset, uint64_t limit, bool exact, std::vector<uint8_t>& record) {
+    uint8_t bytes[4];
+    if (fseeko(file, (off_t) offset, SEEK_SET) != 0 || fread(bytes, 1, 4, file) != 4) {
+        return false;
+    }
+    const uint8_t* p = bytes;
+    uint64_t len = get_le(p, 4);
+    if (len < record_header_len || len > limit - offset || (exact && len != limit - offset)) {
+        return false;
+    }
+    record.resize((size_t) len);
+    memcpy(record.data(), bytes, 4);
+    return fread(record.data() + 4, 1, record.size() - 4, file) == record.size() - 4;
+}
+
+//Add the names of a record at offset to the store and put its entries in their slots (a
+//slot past the last chunk is a new chunk); the chunks must be before the record
+static bool apply_record(const std::vector<uint8_t>& record, uint64_t offset, series_store& store) {
+    const uint8_t* p = record.data() + 12;
+    const uint8_t* last = record.data() + record.size();
+    uint32_t first_location = (uint32_t) get_le(p, 4);
+    uint32_t n_names = (uint32_t) get_le(p, 4);
+    if (first_location != store.locations.size()) {
+        return false;
+    }
+    for (uint32_t l = 0; l < n_names; l++) {
+        if (last - p < 2) {
+            return false;
+        }
+        size_t len = (size_t) get_le(p, 2);
+        if ((size_t) (last - p) < len) {
+            return false;
+        }
+        store.locations.emplace_back((const char *) p, len);
+        store.ids.emplace(store.locations.back(), first_location + l);
+        p += len;
+    }
+    if (last - p < 4) {
+        return false;
+    }
+    uint32_t n_entries = (uint32_t) get_le(p, 4);
+    if ((size_t) (last - p) != (size_t) n_entries * (4 + chunk_entry_len)) {
+        return false;
+    }
+    for (uint32_t c = 0; c < n_entries; c++) {
+        uint32_t slot = (uint32_t) get_le(p, 4);
+        chunk_entry entry;
+        entry.location = (uint32_t) get_le(p, 4);
+        entry.count = (uint32_t) get_le(p, 4);
+        entry.first = (int64_t) get_le(p, 8);
+        entry.last = (int64_t) get_le(p, 8);
+        entry.offset = get_le(p, 8);
+        entry.bytes = (uint32_t) get_le(p, 4);
+        entry.flags = (uint32_t) get_le(p, 4);
+        if (slot > store.chunks.size() || entry.location >= store.locations.size() || entry.offset < header_len ||
+            entry.offset + entry.bytes > offset) {
+            return false;
+        }
+        if (slot == store.chunks.size()) {
+            store.chunks.push_back(entry);
+        } else {
+            store.chunks[slot] = entry;
+        }
+    }
+    return true;
+}
+
+//Read the index whose trailer ends at end: the records from the newest one back to the
+//last whole index, applied from the oldest; false if there is no valid index there
+static bool read_index(FILE* file, uint64_t end, series_store& store) {
+    uint8_t trailer[trailer_len];
+    if (end < header_len + trailer_len || fseeko(file, (off_t) (end - trailer_len), SEEK_SET) != 0 ||
+        fread(trailer, 1, trailer_len, file) != trailer_len || memcmp(trailer + 8, series_index_magic, 8) != 0) {
+        return false;
+    }
+    const uint8_t* p = trailer;
+    uint64_t newest = get_le(p, 8);
+    if (newest < header_len || newest >= end - trailer_len) {
+        return false;
+    }
+    std::vector<std::vector<uint8_t>> records;
+    std::vector<uint64_t> offsets;
+    uint64_t offset = newest;
+    uint64_t limit = end - trailer_len;
+    while (true) {
+        records.emplace_back();
+        offsets.push_back(offset);
+        if (!read_record(file, offset, limit, records.size() == 1, records.back())) {
+            return false;
+        }
+        p = records.back().data() + 4;
+        uint64_t previous = get_le(p, 8);
+        if (previous == 0) {
+            break;
+        }
+        if (previous < header_len || previous >= offset) {
+            return false;
+        }
+        limit = offset;
+        offset = previous;
+    }
+    std::string path = store.path;
+    store = series_store();
+    store.path = path;
+    for (size_t r = records.size(); r-- > 0;) {
+        if (!apply_record(records[r], offsets[r], store)) {
+            return false;
+        }
+        store.index_bytes += records[r].size();
+    }
+    store.newest_record = newest;
+    store.file_end = end;
+    store.index_records = records.size();
+    store.chain_bytes = store.index_bytes - records.back().size();
+    return true;
+}
+
+bool store_open(const char* path, series_store& store) {
+    store = series_store();
+    store.path = path;
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return true;
+    }
+    uint8_t header[header_len];
+    size_t header_read = fread(header, 1, header_len, file);
+    uint8_t expected[header_len];
+    memcpy(expected, series_magic, 8);
+    for (int i = 0; i < 8; i++) {
+        expected[8 + i] = i < 4 ? (uint8_t) (series_version >> (8 * i)) : 0;
+    }
+    if (memcmp(header, expected, header_read) != 0 || fseeko(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return false;
+    }
+    if (header_read < header_len) {
+        //The first append stopped while writing the header: a new store
+        fclose(file);
+        return true;
+    }
+    uint64_t size = (uint64_t) ftello(file);
+    bool found = read_index(file, size, store);
+    //An append that did not finish leaves its bytes after the last complete trailer: look
+    //for it backwards, the next append writes over them
+    uint8_t block[1 << 16];
+    uint64_t end = size;
+    while (!found && end > header_len + trailer_len) {
+        uint64_t start = std::max((uint64_t) header_len, end >= sizeof(block) ? end - sizeof(block) : 0);
+        size_t len = (size_t) (end - start);
+        if (fseeko(file, (off_t) start, SEEK_SET) != 0 || fread(block, 1, len, file) != len) {
+            break;
+        }
+        for (size_t i = len; i >= 8 && !found; i--) {
+            if (memcmp(block + i - 8, series_index_magic, 8) == 0) {
+                found = read_index(file, start + i, store);
+            }
+        }
+        //Overlap a magic split between two blocks
+        end = start + 7;
+        if (start == header_len) {
+            break;
+        }
+    }
+    fclose(file);
+    if (!found) {
+        //No append ever finished (every one writes a trailer and the next ones never write
+        //before it): an empty store, whose first append writes after the header
+        store = series_store();
+        store.path = path;
+        store.file_end = header_len;
+    }
+    return true;
+}
+
+bool store_append(series_store& store, series_batch& batch) {
+    FILE* file = fopen(store.path.c_str(), store.file_end == 0 ? "w+b" : "r+b");
+    if (file == NULL) {
+        return false;
+    }
+    //The store after the append, kept only when the file is written
+    series_store next = store;
+    std::vector<uint8_t> bytes;
+    if (next.file_end == 0) {
+        bytes.insert(bytes.end(), series_magic, series_magic + 8);
+        put_le(bytes, series_version, 4);
+        put_le(bytes, 0, 4);
+        next.file_end = header_len;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    //The new chunks, index record and trailer go after the current ones, which stay valid
+    //until the new trailer is on the disk
+    uint64_t position = next.file_end;
+
+    //Last chunk of every location: while it is not full it is encoded again with the new
+    //readings, so that small appends do not leave small chunks
+    std::vector<int64_t> tails(next.locations.size(), -1);
+    for (size_t c = 0; c < next.chunks.size(); c++) {
+        tails[next.chunks[c].location] = (int64_t) c;
+    }
+    //The locations in name order, so that the file does not depend on the hash map
+    std::vector<std::string> names;
+    for (auto& location : batch) {
+        if (!location.second.empty()) {
+            names.push_back(location.first);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    uint32_t first_location = (uint32_t) next.locations.size();
+    std::vector<uint32_t> slots;
+    std::vector<series_reading> readings;
+    for (const std::string& name : names) {
+        auto found = next.ids.find(name);
+        uint32_t location;
+        readings.clear();
+        int64_t slot = -1;
+        if (found != next.ids.end()) {
+            location = found->second;
+            slot = tails[location];
+        } else {
+            location = (uint32_t) next.locations.size();
+            next.locations.push_back(name);
+            next.ids.emplace(name, location);
+        }
+        if (slot >= 0 && next.chunks[(size_t) slot].count < series_chunk_readings) {
+            const chunk_entry& tail = next.chunks[(size_t) slot];
+            bytes.resize(tail.bytes);
+            written = written && fseeko(file, (off_t) tail.offset, SEEK_SET) == 0 &&
+                      fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+            decode_chunk(bytes.data(), bytes.size(), tail.flags, tail.first, tail.count, readings);
+        } else {
+            slot = -1;
+        }
+        readings.insert(readings.end(), batch[name].begin(), batch[name].end());
+        std::stable_sort(readings.begin(), readings.end(), [](const series_reading& a, const series_reading& b) {
+            return a.epoch < b.epoch;
+        });
+        for (size_t start = 0; start < readings.size(); start += series_chunk_readings) {
+            size_t count = std::min((size_t) series_chunk_readings, readings.size() - start);
+            bytes.clear();
+            chunk_entry entry;
+            entry.location = location;
+            entry.count = (uint32_t) count;
+            entry.first = readings[start].epoch;
+            entry.last = readings[start + count - 1].epoch;
+            entry.offset = position;
+            entry.flags = encode_chunk(&readings[start], count, bytes);
+            entry.bytes = (uint32_t) bytes.size();
+            written = written && fseeko(file, (off_t) position, SEEK_SET) == 0 &&
+                      fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+            position += bytes.size();
+            //The first one takes the place of the tail
+            if (slot >= 0) {
+                next.chunks[(size_t) slot] = entry;
+                slots.push_back((uint32_t) slot);
+                slot = -1;
+            } else {
+                slots.push_back((uint32_t) next.chunks.size());
+                next.chunks.push_back(entry);
+            }
+        }
+    }
+
+    //A record of the new names and chunks that points to the previous one, or the whole
+    //index when the records since the last whole one would be longer than it
+    bytes.clear();
+    put_record(bytes, next, first_location, slots, next.newest_record);
+    bool whole = next.newest_record == 0 || next.chain_bytes + bytes.size() > whole_record_len(next);
+    if (whole) {
+        bytes.clear();
+        slots.resize(next.chunks.size());
+        for (size_t c = 0; c < slots.size(); c++) {
+            slots[c] = (uint32_t) c;
+        }
+        put_record(bytes, next, 0, slots, 0);
+        next.index_bytes = 0;
+        next.index_records = 0;
+        next.chain_bytes = 0;
+    } else {
+        next.chain_bytes += bytes.size();
+    }
+    next.index_bytes += bytes.size();
+    next.index_records++;
+    next.newest_record = position;
+    put_le(bytes, position, 8);
+    bytes.insert(bytes.end(), series_index_magic, series_index_magic + 8);
+    next.file_end = position + bytes.size();
+    //The truncate drops what is left of an append that did not finish
+    written = written && fseeko(file, (off_t) position, SEEK_SET) == 0 &&
+              fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size() && fflush(file) == 0 &&
+              ftruncate(fileno(file), (off_t) next.file_end) == 0 && fsync(fileno(file)) == 0;
+    if (!written) {
+        //Leave the old trailer at the end (e.g. when the disk is full)
+        fflush(file);
+        if (ftruncate(fileno(file), (off_t) store.file_end) != 0) {
+            perror(store.path.c_str());
+        }
+    }
+    if (fclose(file) != 0 || !written) {
+        return false;
+    }
+    store = std::move(next);
+    return true;
+}
+
+uint64_t store_used_bytes(const series_store& store) {
+    if (store.newest_record == 0) {
+        return 0;
+    }
+    uint64_t used = header_len + store.index_bytes + trailer_len;
+    for (const chunk_entry& entry : store.chunks) {
+        used += entry.bytes;
+    }
+    return used;
+}
+
+bool store_query(const series_store& store, const std::vector<bool>& wanted, int64_t from, int64_t to,
+                 std::vector<std::pair<uint32_t, series_reading>>& out, query_stats& stats) {
+    stats = query_stats{0, 0};
+    if (store.chunks.empty()) {
+        return true;
+    }
+    FILE* file = fopen(store.path.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    std::vector<series_reading> readings;
+    for (const chunk_entry& entry : store.chunks) {
+        if (entry.location >= wanted.size() || !wanted[entry.location] || entry.last < from || entry.first > to) {
+            continue;
+        }
+        bytes.resize(entry.bytes);
+        if (fseeko(file, (off_t) entry.offset, SEEK_SET) != 0 || fread(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+            fclose(file);
+            return false;
+        }
+        stats.chunks_read++;
+        stats.bytes_read += bytes.size();
+        readings.clear();
+        decode_chunk(bytes.data(), bytes.size(), entry.flags, entry.first, entry.count, readings);
+        for (const series_reading& reading : readings) {
+            if (reading.epoch >= from && reading.epoch <= to) {
+                out.emplace_back(entry.location, reading);
+            }
+        }
+    }
+    fclose(file);
+    std::stable_sort(out.begin(), out.end(), [](const std::pair<uint32_t, series_reading>& a,
+                                                const std::pair<uint32_t, series_reading>& b) {
+        return a.second.epoch < b.second.epoch;
+    });
+    return true;
+}
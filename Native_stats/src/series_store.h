@@ -0,0 +1,112 @@
+#ifndef SERIES_STORE_H
+#define SERIES_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Compressed store of the sensor readings, in place of the text appended to DB.csv.
+//The readings of every location are kept in chunks of at most series_chunk_readings,
+//sorted by time and encoded as a bit stream:
+//- the timestamps as delta of delta (Gorilla): '0' when the interval is the same as the
+//  previous one, otherwise a prefix and 7, 9, 12 or 20 bits of the difference, in
+//  minutes when every reading of the chunk is on a whole minute; a difference that needs
+//  more than 20 bits (a gap of years in minutes) is written whole in 64 bits after the
+//  prefix '11111'
+//- temperature and humidity, when every value of the chunk has at most 2 decimals (as
+//  the ones sent by the motes), as the difference from the previous value in hundredths
+//  with the same kind of prefixes; otherwise as the XOR of their float bits (Gorilla)
+//The file is: header | chunks and index records | trailer. The index has the names of
+//the locations and, for every chunk, its location, the time of its first and last
+//reading and where it is: a query reads the index and then only the chunks of the
+//locations and of the time it asks for. Opening reads the header, the trailer (where the
+//newest index record is) and the records back to the last whole index.
+//An append writes its chunks, an index record and a new trailer after the old trailer and
+//syncs the file, so the old index stays valid until the new one is complete: a store
+//whose last append did not finish opens at its last complete trailer. The record has only
+//the new names and the new chunks and points to the previous one; when the records since
+//the last whole index would be longer than it, the append writes the whole index instead.
+//The last chunk of a location, while not full, is encoded again with the new readings and
+//takes its place in the index. The replaced chunks and the old indexes stay in the file
+//until compact writes it again.
+
+#define series_magic "MTDSTSDB"
+#define series_index_magic "MTDSTSIX"
+#define series_version 2
+#define series_chunk_readings 256
+
+//Flags of a chunk
+#define chunk_minutes 1
+#define chunk_decimal 2
+
+struct series_reading {
+    //UTC seconds
+    int64_t epoch;
+    float temperature;
+    float humidity;
+};
+
+struct chunk_entry {
+    uint32_t location;
+    uint32_t count;
+    int64_t first;
+    int64_t last;
+    uint64_t offset;
+    uint32_t bytes;
+    uint32_t flags;
+};
+
+struct series_store {
+    std::string path;
+    std::vector<std::string> locations;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<chunk_entry> chunks;
+    //Offset of the newest index record (0 when there is none) and end of the trailer, where
+    //the next append writes (0 for a new file)
+    uint64_t newest_record = 0;
+    uint64_t file_end = 0;
+    //Bytes and number of the index records from the last whole index on, and the bytes of
+    //the ones after it
+    uint64_t index_bytes = 0;
+    size_t index_records = 0;
+    uint64_t chain_bytes = 0;
+};
+
+//Readings to append, by location (in any order)
+typedef std::unordered_map<std::string, std::vector<series_reading>> series_batch;
+
+//Open the store and read its index; a missing file, or one whose first append did not
+//finish, is an empty store. Returns false if the file exists and it is not a store.
+bool store_open(const char* path, series_store& store);
+
+//Append the readings of the batch as new chunks and an index record; the store is left as
+//it was when the file cannot be written
+bool store_append(series_store& store, series_batch& batch);
+
+//Bytes of the file used by the header, the chunks, the index and the trailer: the others
+//(replaced chunks, old indexes, what is left of an append that did not finish) are the
+//ones that compact drops
+uint64_t store_used_bytes(const series_store& store);
+
+//Counters of a query
+struct query_stats {
+    size_t chunks_read;
+    size_t bytes_read;
+};
+
+//Readings in [from, to] of the locations whose flag in wanted is set (indexed by location
+//id), each with its location id, sorted by time (the ones at the same time in the order
+//of their chunks)
+bool store_query(const series_store& store, const std::vector<bool>& wanted, int64_t from, int64_t to,
+                 std::vector<std::pair<uint32_t, series_reading>>& out, query_stats& stats);
+
+//Encode the readings (sorted by time) as a chunk; returns its flags
+uint32_t encode_chunk(const series_reading* readings, size_t count, std::vector<uint8_t>& bytes);
+
+//Decode the count readings of a chunk starting at first
+void decode_chunk(const uint8_t* bytes, size_t len, uint32_t flags, int64_t first, size_t count,
+                  std::vector<series_reading>& out);
+
+#endif
@@ -0,0 +1,173 @@
+#include "snapshot.h"
+#include "csv_parser.h"
+#include "location_dictionary.h"
+#include "rome_time.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+bool is_snapshot(const char* path) {
+    char magic[8];
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    bool found = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, snapshot_magic, 8) == 0;
+    fclose(file);
+    return found;
+}
+
+static inline uint64_t align_up(uint64_t offset) {
+    return (offset + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+}
+
+//Write the bytes at the offset, filling with zeros from the current end
+static void write_at(FILE* file, uint64_t& end, uint64_t offset, const void* data, size_t len) {
+    static const char zeros[snapshot_alignment] = {0};
+    fwrite(zeros, 1, (size_t) (offset - end), file);
+    fwrite(data, 1, len, file);
+    end = offset + len;
+}
+
+bool write_snapshot(const char* csv, const char* path) {
+    mapped_file file;
+    if (!map_file(csv, file)) {
+        fprintf(stderr, "Cannot read %s\n", csv);
+        return false;
+    }
+    location_dictionary locations;
+    std::vector<uint32_t> location_id;
+    std::vector<int32_t> epoch_minute;
+    std::vector<float> temperature;
+    std::vector<float> humidity;
+    reading_parser parser;
+    parser_init(parser, file.data, file.len);
+    sensor_row row;
+    while (parser_next(parser, row)) {
+        int64_t epoch = rome_to_epoch(row.local_seconds);
+        if (epoch % 60 != 0) {
+            fprintf(stderr, "Reading not on a whole minute at line %zu of %s\n", location_id.size() + parser.skipped + 2, csv);
+            unmap_file(file);
+            return false;
+        }
+        location_id.push_back(location_intern(locations, std::string_view(row.location, row.location_len)));
+        epoch_minute.push_back((int32_t) (epoch / 60));
+        temperature.push_back(row.temperature);
+        humidity.push_back(row.humidity);
+    }
+    unmap_file(file);
+
+    std::vector<uint64_t> offsets(1, 0);
+    std::string text;
+    for (const std::string& code : locations.codes) {
+        text += code;
+        offsets.push_back(text.size());
+    }
+    snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, snapshot_magic, 8);
+    header.version = snapshot_version;
+    header.byte_order = snapshot_byte_order;
+    header.rows = location_id.size();
+    header.n_locations = locations.codes.size();
+    header.location_offsets = snapshot_header_len;
+    header.location_text = header.location_offsets + offsets.size() * sizeof(uint64_t);
+    header.location_id = align_up(header.location_text + text.size());
+    header.epoch_minute = align_up(header.location_id + header.rows * sizeof(uint32_t));
+    header.temperature = align_up(header.epoch_minute + header.rows * sizeof(int32_t));
+    header.humidity = align_up(header.temperature + header.rows * sizeof(float));
+    header.file_len = header.humidity + header.rows * sizeof(float);
+
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return false;
+    }
+    char header_bytes[snapshot_header_len] = {0};
+    memcpy(header_bytes, &header, sizeof(header));
+    uint64_t end = 0;
+    write_at(out, end, 0, header_bytes, sizeof(header_bytes));
+    write_at(out, end, header.location_offsets, offsets.data(), offsets.size() * sizeof(uint64_t));
+    write_at(out, end, header.location_text, text.data(), text.size());
+    write_at(out, end, header.location_id, location_id.data(), location_id.size() * sizeof(uint32_t));
+    write_at(out, end, header.epoch_minute, epoch_minute.data(), epoch_minute.size() * sizeof(int32_t));
+    write_at(out, end, header.temperature, temperature.data(), temperature.size() * sizeof(float));
+    write_at(out, end, header.humidity, humidity.data(), humidity.size() * sizeof(float));
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+//Whether the section [offset, offset + len) is inside the file
+static bool inside(const snapshot_header& header, uint64_t offset, uint64_t len) {
+    return offset <= header.file_len && len <= header.file_len - offset;
+}
+
+bool open_snapshot(const char* path, snapshot_view& view) {
+    memset(&view, 0, sizeof(view));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < snapshot_header_len) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    view.data = data;
+    view.len = (size_t) info.st_size;
+    snapshot_header header;
+    memcpy(&header, data, sizeof(header));
+    uint64_t rows = header.rows;
+    if (memcmp(header.magic, snapshot_magic, 8) != 0 || header.version != snapshot_version ||
+        header.byte_order != snapshot_byte_order || header.file_len != view.len || header.n_locations >= view.len ||
+        rows > view.len ||
+        !inside(header, header.location_offsets, (header.n_locations + 1) * sizeof(uint64_t)) ||
+        !inside(header, header.location_id, rows * sizeof(uint32_t)) ||
+        !inside(header, header.epoch_minute, rows * sizeof(int32_t)) ||
+        !inside(header, header.temperature, rows * sizeof(float)) ||
+        !inside(header, header.humidity, rows * sizeof(float))) {
+        close_snapshot(view);
+        return false;
+    }
+    const char* base = (const char *) data;
+    view.rows = (size_t) rows;
+    view.n_locations = (size_t) header.n_locations;
+    view.location_offsets = (const uint64_t *) (base + header.location_offsets);
+    view.location_text = base + header.location_text;
+    //The codes are [offset l, offset l + 1): the offsets must not decrease, so that every
+    //code is inside the text checked with the last one
+    bool valid = inside(header, header.location_text, view.location_offsets[view.n_locations]);
+    for (size_t l = 0; valid && l < view.n_locations; l++) {
+        valid = view.location_offsets[l] <= view.location_offsets[l + 1];
+    }
+    if (!valid) {
+        close_snapshot(view);
+        return false;
+    }
+    view.location_id = (const uint32_t *) (base + header.location_id);
+    view.epoch_minute = (const int32_t *) (base + header.epoch_minute);
+    view.temperature = (const float *) (base + header.temperature);
+    view.humidity = (const float *) (base + header.humidity);
+    return true;
+}
+
+void close_snapshot(snapshot_view& view) {
+    if (view.data != NULL) {
+        munmap((void *) view.data, view.len);
+    }
+    memset(&view, 0, sizeof(view));
+}
@@ -0,0 +1,65 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+
+//Binary columnar snapshot of the readings, written once from the CSV and then mapped in
+//memory: its columns are read without parsing (the dataset copies them). The file is
+//- a header of snapshot_header_len bytes (magic, version, number of rows and locations and
+//  the offset of every section)
+//- the locations: n_locations + 1 offsets of their codes, then the codes
+//- the columns, every one starting on a multiple of snapshot_alignment bytes: location id
+//  (uint32_t, index of the location), time (int32_t, UTC minutes since the epoch),
+//  temperature and humidity (float)
+//Numbers are in the byte order of the machine that wrote the file; the header has a
+//marker to refuse a file of the other order.
+
+#define snapshot_magic "MTDSCOL1"
+#define snapshot_version 1
+#define snapshot_header_len 128
+#define snapshot_alignment 64
+#define snapshot_byte_order 0x01020304u
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t rows;
+    uint64_t n_locations;
+    //Offsets from the start of the file
+    uint64_t location_offsets;
+    uint64_t location_text;
+    uint64_t location_id;
+    uint64_t epoch_minute;
+    uint64_t temperature;
+    uint64_t humidity;
+    uint64_t file_len;
+};
+
+//Columns of a mapped snapshot; they live as long as the mapping
+struct snapshot_view {
+    const void* data;
+    size_t len;
+    size_t rows;
+    size_t n_locations;
+    const uint64_t* location_offsets;
+    const char* location_text;
+    const uint32_t* location_id;
+    const int32_t* epoch_minute;
+    const float* temperature;
+    const float* humidity;
+};
+
+//Whether the file starts with the magic of a snapshot
+bool is_snapshot(const char* path);
+
+//Parse the CSV and write its snapshot. Returns false (with a message) if the CSV cannot
+//be read, the snapshot cannot be written or a reading is not on a whole minute.
+bool write_snapshot(const char* csv, const char* path);
+
+//Map the snapshot and check its header and sections
+bool open_snapshot(const char* path, snapshot_view& view);
+void close_snapshot(snapshot_view& view);
+
+#endif
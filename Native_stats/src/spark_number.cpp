@@ -0,0 +1,90 @@
+#include "spark_number.h"
+
+#include <charconv>
+#include <cmath>
+
+//Rounding of the decimal digits of the shortest representation, only needed
+//when the value is close to a tie
+static double bround2_slow(double x) {
+    char buffer[400];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), x, std::chars_format::fixed);
+    const char* p = buffer;
+    const char* end = result.ptr;
+    bool negative = *p == '-';
+    if (negative) {
+        p++;
+    }
+    long long cents = 0;
+    while (p < end && *p != '.') {
+        cents = cents * 10 + (*p++ - '0');
+    }
+    int fraction_digits = 0;
+    int first_rest = 0;
+    bool rest_nonzero = false;
+    if (p < end) {
+        p++;
+    }
+    for (; p < end; p++, fraction_digits++) {
+        if (fraction_digits < 2) {
+            cents = cents * 10 + (*p - '0');
+        } else if (fraction_digits == 2) {
+            first_rest = *p - '0';
+        } else if (*p != '0') {
+            rest_nonzero = true;
+        }
+    }
+    for (; fraction_digits < 2; fraction_digits++) {
+        cents *= 10;
+    }
+    if (first_rest > 5 || (first_rest == 5 && (rest_nonzero || (cents & 1)))) {
+        cents++;
+    }
+    //BigDecimal has no negative zero
+    if (cents == 0) {
+        return 0.0;
+    }
+    return (negative ? -(double) cents : (double) cents) / 100.0;
+}
+
+double bround2(double x) {
+    if (!std::isfinite(x)) {
+        return x;
+    }
+    double scaled = std::fabs(x) * 100.0;
+    double floor_scaled = std::floor(scaled);
+    //Away from a tie the digits of the shortest representation round like the exact value
+    if (std::fabs(scaled - floor_scaled - 0.5) > 1e-6 && scaled < 1e12) {
+        long long cents = (long long) floor_scaled + (scaled - floor_scaled > 0.5);
+        if (cents == 0) {
+            return 0.0;
+        }
+        return (x < 0 ? -(double) cents : (double) cents) / 100.0;
+    }
+    return bround2_slow(x);
+}
+
+char* write_rounded(char* out, double rounded) {
+    long long cents = std::llround(rounded * 100.0);
+    if (cents < 0) {
+        *out++ = '-';
+        cents = -cents;
+    }
+    //Digits of the integer part written backwards, then copied
+    char digits[24];
+    int n = 0;
+    long long integer = cents / 100;
+    do {
+        digits[n++] = (char) ('0' + integer % 10);
+        integer /= 10;
+    } while (integer > 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    int fraction = (int) (cents % 100);
+    *out++ = '.';
+    *out++ = (char) ('0' + fraction / 10);
+    if (fraction % 10 != 0) {
+        *out++ = (char) ('0' + fraction % 10);
+    }
+    return out;
+}
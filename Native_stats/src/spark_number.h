@@ -0,0 +1,15 @@
+#ifndef SPARK_NUMBER_H
+#define SPARK_NUMBER_H
+
+//bround(x, 2) of Spark: the shortest decimal representation of the double
+//(what java.lang.Double.toString prints) rounded to 2 decimals with HALF_EVEN
+double bround2(double x);
+
+//Longest text written by write_rounded
+#define rounded_max_len 24
+
+//Write a value returned by bround2 the way java.lang.Double.toString prints it
+//(e.g. 25.3, 25.0, -0.05) and return the end of the text
+char* write_rounded(char* out, double rounded);
+
+#endif
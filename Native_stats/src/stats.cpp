@@ -0,0 +1,333 @@
+//Native version of Spark_csv/src/main/java/it/polimi/mtds/Stats.java: the readings
+//are loaded once into columns and every table of ../Stats is computed from them.
+#include "dataset.h"
+#include "rollup.h"
+#include "rome_time.h"
+#include "spark_number.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+static const char* level_columns[level_count] = {"fullRoomLocation", "fullFloorLocation", "fullBuildingLocation",
+                                                 "neighborhood"};
+static const char* level_suffixes[level_count] = {"Room", "Floor", "Building", "Neighborhood"};
+
+//Moving average windows: RANGE BETWEEN INTERVAL ... PRECEDING AND CURRENT ROW.
+//An interval of hours is a fixed number of seconds, an interval of days is made of
+//calendar days of the local time zone.
+struct window_spec {
+    const char* name;
+    int64_t seconds;
+    int days;
+};
+static const window_spec windows[] = {{"Hour", 3600, 0}, {"Daily", 0, 1}, {"Weekly", 0, 7}};
+
+//First instant of the window ending at every row
+static void window_starts(const dataset& data, const window_spec& window, std::vector<int64_t>& starts) {
+    starts.resize(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        starts[i] = window.days > 0 ? rome_minus_days(data.epoch[i], window.days) : data.epoch[i] - window.seconds;
+    }
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool write_table(const std::string& dir, const std::string& name, const char* begin, const char* end) {
+    std::string path = dir + "/" + name + ".csv";
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot write %s\n", path.c_str());
+        return false;
+    }
+    fwrite(begin, 1, end - begin, file);
+    fclose(file);
+    return true;
+}
+
+static inline char* write_text(char* out, const char* text, size_t len) {
+    memcpy(out, text, len);
+    return out + len;
+}
+
+static inline char* write_text(char* out, const std::string& text) {
+    return write_text(out, text.data(), text.size());
+}
+
+//Upper bound of the text of a table whose lines hold the location of the level
+static size_t table_capacity(const dataset& data, int level, size_t rows, size_t line_len) {
+    size_t longest = 0;
+    for (const std::string& name : data.locations.names[level]) {
+        longest = std::max(longest, name.size());
+    }
+    return 256 + rows * (longest + line_len);
+}
+
+//Rows sorted by location of the level and time (ties keep the order of the file, as
+//the sort of Spark after a shuffle from a single partition)
+static std::vector<uint32_t> sorted_rows(const dataset& data, int level) {
+    //Location and time packed in one key: the readings span less than 136 years
+    int64_t min_epoch = data.size() > 0 ? *std::min_element(data.epoch.begin(), data.epoch.end()) : 0;
+    std::vector<std::pair<uint64_t, uint32_t>> keys(data.size());
+    for (uint32_t i = 0; i < keys.size(); i++) {
+        keys[i].first = ((uint64_t) data.location(level, i) << 32) | (uint64_t) (data.epoch[i] - min_epoch);
+        keys[i].second = i;
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<uint32_t> order(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        order[i] = keys[i].second;
+    }
+    return order;
+}
+
+//Rounded average of the values in the window ending at every row. As the sliding frame
+//of Spark, the sum of each frame is computed again from its first row, so that the
+//result is the same double.
+static void moving_average(const dataset& data, const std::vector<uint32_t>& order, int level,
+                           const std::vector<float>& values, const std::vector<int64_t>& starts, std::vector<double>& out) {
+    out.resize(data.size());
+    size_t n = order.size();
+    size_t first = 0;
+    size_t i = 0;
+    while (i < n) {
+        uint32_t location = data.location(level, order[i]);
+        if (i == 0 || location != data.location(level, order[i - 1])) {
+            first = i;
+        }
+        int64_t t = data.epoch[order[i]];
+        //The frame ends with the last peer of the current row
+        size_t last = i;
+        while (last + 1 < n && data.location(level, order[last + 1]) == location && data.epoch[order[last + 1]] == t) {
+            last++;
+        }
+        while (first < last && data.epoch[order[first]] < starts[order[i]]) {
+            first++;
+        }
+        double sum = 0;
+        for (size_t j = first; j <= last; j++) {
+            sum += (double) values[order[j]];
+        }
+        double average = bround2(sum / (double) (last - first + 1));
+        for (size_t j = i; j <= last; j++) {
+            out[order[j]] = average;
+        }
+        i = last + 1;
+    }
+}
+
+//Rows of a diff table, also used for the maxMonth table
+struct diff_row {
+    int32_t day;
+    uint32_t location;
+    double day_temp;
+    double day_hum;
+    double night_temp;
+    double night_hum;
+    double temp_diff;
+    double hum_diff;
+};
+
+//groupBy("daily", "day", location) with the averages, then the join of the day and
+//the night means of the same location and day, for a level of the roll-up. The sums of
+//the rooms follow the order of the file as the partial aggregation of Spark over the
+//single partition of the input; the upper levels add the sums of their children.
+static std::vector<diff_row> day_night_diff(const day_rollup& rollup, int level) {
+    std::vector<diff_row> rows;
+    const std::vector<uint32_t>& day_start = rollup.day_start[level];
+    const std::vector<location_day>& cells = rollup.cells[level];
+    for (size_t d = 0; d + 1 < day_start.size(); d++) {
+        for (uint32_t c = day_start[d]; c < day_start[d + 1]; c++) {
+            const location_day& cell = cells[c];
+            if (cell.temperature[0].count > 0 && cell.temperature[1].count > 0) {
+                diff_row row;
+                row.day = rollup.first_day + (int32_t) d;
+                row.location = cell.location;
+                row.day_temp = bround2(cell.temperature[1].sum / (double) cell.temperature[1].count);
+                row.day_hum = bround2(cell.humidity[1].sum / (double) cell.humidity[1].count);
+                row.night_temp = bround2(cell.temperature[0].sum / (double) cell.temperature[0].count);
+                row.night_hum = bround2(cell.humidity[0].sum / (double) cell.humidity[0].count);
+                row.temp_diff = bround2(row.day_temp - row.night_temp);
+                row.hum_diff = bround2(row.day_hum - row.night_hum);
+                rows.push_back(row);
+            }
+        }
+    }
+    return rows;
+}
+
+//Text of a diff table, returns its end
+static char* format_diff(const dataset& data, int level, const std::vector<diff_row>& rows, char* out) {
+    out = write_text(out, std::string("day;") + level_columns[level] + ";day_temp;day_hum;night_temp;night_hum;temp_diff;hum_diff\n");
+    for (const diff_row& row : rows) {
+        format_date(row.day, out);
+        out += 10;
+        *out++ = ';';
+        out = write_text(out, data.locations.name(level, row.location));
+        double values[6] = {row.day_temp, row.day_hum, row.night_temp, row.night_hum, row.temp_diff, row.hum_diff};
+        for (double value : values) {
+            *out++ = ';';
+            out = write_rounded(out, value);
+        }
+        *out++ = '\n';
+    }
+    return out;
+}
+
+//Month of the year with the highest average day-night temperature difference
+static char* format_max_month(const std::vector<diff_row>& rows, char* out) {
+    double sums[13] = {0};
+    long long counts[13] = {0};
+    for (const diff_row& row : rows) {
+        int year, month, day;
+        civil_from_days(row.day, &year, &month, &day);
+        sums[month] += row.temp_diff;
+        counts[month]++;
+    }
+    double max = 0;
+    bool found = false;
+    for (int month = 1; month <= 12; month++) {
+        if (counts[month] > 0 && (!found || sums[month] / (double) counts[month] > max)) {
+            max = sums[month] / (double) counts[month];
+            found = true;
+        }
+    }
+    out = write_text(out, "month;temp\n", 11);
+    for (int month = 1; month <= 12; month++) {
+        if (counts[month] > 0 && sums[month] / (double) counts[month] == max) {
+            out += sprintf(out, "%d;", month);
+            out = write_rounded(out, bround2(max));
+            *out++ = '\n';
+        }
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    const char* input = "../DataOut/dataset.csv";
+    std::string output = "./Stats";
+    bool benchmark = false;
+    int threads = hardware_threads();
+
+    //--bench prints the time of every phase
+    //--input <path> is the CSV or the snapshot to analyze (default ../DataOut/dataset.csv)
+    //--output <dir> is where the tables are written (default ./Stats)
+    //--threads <n> is the number of threads of the diff tables (default the ones of the machine)
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--bench") == 0) {
+            benchmark = true;
+        } else if (strcmp(argv[a], "--input") == 0 && a + 1 < argc) {
+            input = argv[++a];
+        } else if (strcmp(argv[a], "--output") == 0 && a + 1 < argc) {
+            output = argv[++a];
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            threads = atoi(argv[++a]);
+        } else {
+            fprintf(stderr, "Usage: %s [--bench] [--input <csv|snapshot>] [--output <dir>] [--threads <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+    mkdir(output.c_str(), 0755);
+
+    auto start = std::chrono::steady_clock::now();
+    dataset data;
+    if (!load_dataset(input, data)) {
+        fprintf(stderr, "Cannot read %s\n", input);
+        return 1;
+    }
+    double load_time = elapsed_ms(start);
+
+    //The text of the timestamps is shared by all the moving average tables
+    auto compute_start = std::chrono::steady_clock::now();
+    std::vector<char> timestamps(data.size() * 29);
+    for (size_t i = 0; i < data.size(); i++) {
+        format_timestamp(data.epoch[i], &timestamps[i * 29]);
+    }
+    std::vector<uint32_t> orders[level_count];
+    for (int level = 0; level < level_count; level++) {
+        orders[level] = sorted_rows(data, level);
+    }
+    double compute_time = elapsed_ms(compute_start);
+    double write_time = 0;
+
+    //One buffer holds the text of every table in turn
+    std::vector<char> text;
+    std::vector<int64_t> starts;
+    std::vector<double> average_temperature;
+    std::vector<double> average_humidity;
+    for (const window_spec& window : windows) {
+        compute_start = std::chrono::steady_clock::now();
+        window_starts(data, window, starts);
+        //As in Stats.java avg_hum is always partitioned by room
+        moving_average(data, orders[level_room], level_room, data.humidity, starts, average_humidity);
+        compute_time += elapsed_ms(compute_start);
+        for (int level = 0; level < level_count; level++) {
+            compute_start = std::chrono::steady_clock::now();
+            moving_average(data, orders[level], level, data.temperature, starts, average_temperature);
+            text.resize(std::max(text.size(), table_capacity(data, level, data.size(), 29 + 2 * rounded_max_len + 4)));
+            char* p = write_text(text.data(), std::string(level_columns[level]) + ";dateTime;avg_temp;avg_hum\n");
+            for (uint32_t row : orders[level]) {
+                p = write_text(p, data.locations.name(level, data.location(level, row)));
+                *p++ = ';';
+                p = write_text(p, &timestamps[row * 29], 29);
+                *p++ = ';';
+                p = write_rounded(p, average_temperature[row]);
+                *p++ = ';';
+                p = write_rounded(p, average_humidity[row]);
+                *p++ = '\n';
+            }
+            compute_time += elapsed_ms(compute_start);
+            auto write_start = std::chrono::steady_clock::now();
+            std::string name = std::string("movingAverageTemperatureAndHumidity") + window.name + level_suffixes[level];
+            if (!write_table(output, name, text.data(), p)) {
+                return 1;
+            }
+            write_time += elapsed_ms(write_start);
+        }
+    }
+
+    //One scan of the readings for the day and night aggregates of all the levels
+    compute_start = std::chrono::steady_clock::now();
+    day_rollup rollup;
+    build_day_rollup(data, rollup, threads);
+    compute_time += elapsed_ms(compute_start);
+    for (int level = 0; level < level_count; level++) {
+        compute_start = std::chrono::steady_clock::now();
+        std::vector<diff_row> rows = day_night_diff(rollup, level);
+        //Stats.java writes nothing when there is no difference to compute
+        if (rows.empty()) {
+            compute_time += elapsed_ms(compute_start);
+            continue;
+        }
+        text.resize(std::max(text.size(), table_capacity(data, level, rows.size(), 11 + 6 * (rounded_max_len + 1) + 1)));
+        char* diff_end = format_diff(data, level, rows, text.data());
+        char max_month[512];
+        char* max_month_end = format_max_month(rows, max_month);
+        compute_time += elapsed_ms(compute_start);
+        auto write_start = std::chrono::steady_clock::now();
+        if (!write_table(output, std::string("diff") + level_suffixes[level], text.data(), diff_end) ||
+            !write_table(output, std::string("maxMonth") + level_suffixes[level], max_month, max_month_end)) {
+            return 1;
+        }
+        write_time += elapsed_ms(write_start);
+    }
+
+    if (benchmark) {
+        const location_dictionary& locations = data.locations;
+        printf("Rows: %zu, skipped lines: %zu, rooms: %zu\n", data.size(), data.skipped, locations.codes.size());
+        printf("Location keys: %d bits (neighborhood %d, building %d, floor %d, room %d)\n",
+               locations.shifts[level_neighborhood] + locations.widths[level_neighborhood], locations.widths[level_neighborhood],
+               locations.widths[level_building], locations.widths[level_floor], locations.widths[level_room]);
+        printf("Timings (ms): load=%.3f compute=%.3f write=%.3f total=%.3f\n", load_time, compute_time, write_time,
+               elapsed_ms(start));
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+//Streaming moving averages: the readings are read one line at a time (from a file or
+//from the standard input, e.g. tail -f DB.csv | ./stream_averages) and the Hour, Daily and
+//Weekly averages of every location of every level are kept up to date, without storing
+//or replaying the history. A snapshot of the averages at the time of the newest reading
+//is printed every --every readings and at the end of the input.
+#include "csv_parser.h"
+#include "rome_time.h"
+#include "spark_number.h"
+#include "streaming_average.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static const char* level_names[level_count] = {"room", "floor", "building", "neighborhood"};
+
+//Split a line Location;Date Time;Temperature;Humidity and add it; false if it is malformed
+static bool add_line(streaming_averages& averages, const char* line, size_t len) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        len--;
+    }
+    const char* fields[4];
+    size_t lengths[4];
+    const char* p = line;
+    const char* end = line + len;
+    for (int f = 0; f < 4; f++) {
+        const char* separator = f < 3 ? (const char *) memchr(p, ';', end - p) : end;
+        if (separator == NULL) {
+            return false;
+        }
+        fields[f] = p;
+        lengths[f] = separator - p;
+        p = separator + 1;
+    }
+    int64_t local_seconds;
+    float temperature, humidity;
+    if (lengths[0] == 0 || !parse_timestamp(fields[1], lengths[1], &local_seconds) ||
+        !parse_float(fields[2], lengths[2], &temperature) || !parse_float(fields[3], lengths[3], &humidity)) {
+        return false;
+    }
+    streaming_add(averages, std::string_view(fields[0], lengths[0]), rome_to_epoch(local_seconds), temperature,
+                  humidity);
+    return true;
+}
+
+//level;location;window;dateTime;avg_temp;avg_hum;readings of every non empty window
+static void print_snapshot(const streaming_averages& averages, FILE* out) {
+    char time[30];
+    format_timestamp(averages.latest, time);
+    time[29] = '\0';
+    char text[2 * rounded_max_len + 2];
+    fprintf(out, "level;location;window;dateTime;avg_temp;avg_hum;readings\n");
+    for (int level = 0; level < level_count; level++) {
+        for (uint32_t id = 0; id < averages.names[level].size(); id++) {
+            for (int w = 0; w < stream_window_count; w++) {
+                stream_average average = streaming_query(averages, level, id, w, averages.latest);
+                if (average.count == 0) {
+                    continue;
+                }
+                char* p = write_rounded(text, bround2(average.temperature_sum / (double) average.count));
+                *p++ = ';';
+                p = write_rounded(p, bround2(average.humidity_sum / (double) average.count));
+                *p = '\0';
+                fprintf(out, "%s;%s;%s;%s;%s;%lld\n", level_names[level], averages.names[level][id].c_str(),
+                        stream_windows[w].name, time, text, average.count);
+            }
+        }
+    }
+    fflush(out);
+}
+
+int main(int argc, char** argv) {
+    const char* input = "-";
+    const char* output = NULL;
+    size_t every = 0;
+    bool benchmark = false;
+
+    //--input <path> is the CSV to follow, - for the standard input (default)
+    //--output <path> is where the snapshots are written (default the standard output)
+    //--every <n> prints a snapshot every n readings, besides the one at the end
+    //--bench prints the number of readings and the time per update
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--bench") == 0) {
+            benchmark = true;
+        } else if (strcmp(argv[a], "--input") == 0 && a + 1 < argc) {
+            input = argv[++a];
+        } else if (strcmp(argv[a], "--output") == 0 && a + 1 < argc) {
+            output = argv[++a];
+        } else if (strcmp(argv[a], "--every") == 0 && a + 1 < argc) {
+            every = (size_t) atoll(argv[++a]);
+        } else {
+            fprintf(stderr, "Usage: %s [--bench] [--input <csv>|-] [--output <file>] [--every <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+    FILE* in = strcmp(input, "-") == 0 ? stdin : fopen(input, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Cannot read %s\n", input);
+        return 1;
+    }
+    FILE* out = output == NULL ? stdout : fopen(output, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Cannot write %s\n", output);
+        return 1;
+    }
+
+    streaming_averages averages;
+    size_t skipped = 0;
+    double update_time = 0;
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    bool header = true;
+    while ((len = getline(&line, &capacity, in)) != -1) {
+        auto start = std::chrono::steady_clock::now();
+        bool added = add_line(averages, line, (size_t) len);
+        update_time += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        //The header of the file (or any malformed line) is skipped
+        if (!added) {
+            skipped += !header;
+        } else if (every > 0 && averages.readings % every == 0) {
+            print_snapshot(averages, out);
+        }
+        header = false;
+    }
+    free(line);
+    if (averages.readings > 0) {
+        print_snapshot(averages, out);
+    }
+
+    if (benchmark) {
+        fprintf(stderr, "Readings: %zu, skipped lines: %zu, late readings: %zu, rooms: %zu\n", averages.readings,
+                skipped, averages.late, averages.rooms.codes.size());
+        fprintf(stderr, "Update time (ms): total=%.3f per reading=%.6f\n", update_time,
+                averages.readings > 0 ? update_time / (double) averages.readings : 0.0);
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "streaming_average.h"
+
+//Index of the bucket of the instant, rounding down also before 1970
+static inline int64_t bucket_index(int64_t epoch, int64_t bucket_seconds) {
+    int64_t index = epoch / bucket_seconds;
+    return epoch % bucket_seconds < 0 ? index - 1 : index;
+}
+
+static inline size_t slot_of(int64_t index, size_t slots) {
+    int64_t slot = index % (int64_t) slots;
+    return (size_t) (slot < 0 ? slot + (int64_t) slots : slot);
+}
+
+void window_init(sliding_window& window, const stream_window_spec& spec) {
+    window.bucket_seconds = spec.bucket_seconds;
+    //The buckets before the one of the query plus that one
+    window.ring.assign((size_t) spec.buckets + 1, stream_bucket{-1, 0, 0, 0});
+}
+
+bool window_late(const sliding_window& window, int64_t epoch) {
+    int64_t index = bucket_index(epoch, window.bucket_seconds);
+    return window.ring[slot_of(index, window.ring.size())].index > index;
+}
+
+bool window_add(sliding_window& window, int64_t epoch, float temperature, float humidity) {
+    int64_t index = bucket_index(epoch, window.bucket_seconds);
+    stream_bucket& bucket = window.ring[slot_of(index, window.ring.size())];
+    if (bucket.index > index) {
+        return false;
+    }
+    if (bucket.index < index) {
+        bucket = stream_bucket{index, 0, 0, 0};
+    }
+    bucket.temperature_sum += (double) temperature;
+    bucket.humidity_sum += (double) humidity;
+    bucket.count++;
+    return true;
+}
+
+stream_average window_query(const sliding_window& window, int64_t epoch) {
+    int64_t last = bucket_index(epoch, window.bucket_seconds);
+    int64_t first = last - (int64_t) window.ring.size() + 1;
+    stream_average average = {0, 0, 0};
+    for (const stream_bucket& bucket : window.ring) {
+        if (bucket.index >= first && bucket.index <= last) {
+            average.temperature_sum += bucket.temperature_sum;
+            average.humidity_sum += bucket.humidity_sum;
+            average.count += bucket.count;
+        }
+    }
+    return average;
+}
+
+//Id of the location of the level with the name, with new windows the first time
+static uint32_t level_id(streaming_averages& averages, int level, const std::string& name) {
+    auto found = averages.ids[level].find(name);
+    if (found != averages.ids[level].end()) {
+        return found->second;
+    }
+    uint32_t id = (uint32_t) averages.names[level].size();
+    averages.ids[level].emplace(name, id);
+    averages.names[level].push_back(name);
+    for (const stream_window_spec& spec : stream_windows) {
+        averages.windows[level].emplace_back();
+        window_init(averages.windows[level].back(), spec);
+    }
+    return id;
+}
+
+void streaming_add(streaming_averages& averages, std::string_view code, int64_t epoch, float temperature,
+                   float humidity) {
+    uint32_t room = location_intern(averages.rooms, code);
+    if (room == averages.parents[level_room].size()) {
+        const std::string& full = averages.rooms.codes[room];
+        for (int level = 0; level < level_count; level++) {
+            averages.parents[level].push_back(level_id(averages, level, location_name(full, level)));
+        }
+    }
+    averages.readings++;
+    //A reading too late for one ring is left out of all of them, so that the windows of a
+    //location and of its parents keep counting the same readings
+    for (int level = 0; level < level_count; level++) {
+        const sliding_window* windows = &averages.windows[level][averages.parents[level][room] * stream_window_count];
+        for (int w = 0; w < stream_window_count; w++) {
+            if (window_late(windows[w], epoch)) {
+                averages.late++;
+                return;
+            }
+        }
+    }
+    for (int level = 0; level < level_count; level++) {
+        sliding_window* windows = &averages.windows[level][averages.parents[level][room] * stream_window_count];
+        for (int w = 0; w < stream_window_count; w++) {
+            window_add(windows[w], epoch, temperature, humidity);
+        }
+    }
+    if (epoch > averages.latest) {
+        averages.latest = epoch;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef STREAMING_AVERAGE_H
+#define STREAMING_AVERAGE_H
+
+#include "location_dictionary.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//Moving averages kept up to date reading by reading, without the history. Every window
+//is a ring of buckets of fixed length with the sums and the count of their readings:
+//a reading goes to the slot of its bucket (the bucket index modulo the slots), which is
+//emptied first when it still holds an older bucket, so an update is constant time. A
+//query adds the buckets not older than the window, at most one ring.
+
+//Windows of the streaming averages: bucket length and number of buckets before the one of
+//the query time. With buckets of one minute the Hour window has the readings of the 60
+//minutes before plus the current one, as RANGE INTERVAL 1 HOUR PRECEDING for readings on
+//whole minutes; Daily and Weekly are 24 and 168 hours (not calendar days) to the bucket.
+struct stream_window_spec {
+    const char* name;
+    int64_t bucket_seconds;
+    int buckets;
+};
+#define stream_window_count 3
+static const stream_window_spec stream_windows[stream_window_count] = {
+    {"Hour", 60, 60}, {"Daily", 900, 96}, {"Weekly", 3600, 168}};
+
+struct stream_bucket {
+    //Index of the bucket (time / bucket length), -1 when the slot was never used
+    int64_t index;
+    double temperature_sum;
+    double humidity_sum;
+    long long count;
+};
+
+//Sums of a window at a query time
+struct stream_average {
+    double temperature_sum;
+    double humidity_sum;
+    long long count;
+};
+
+//Ring of the buckets of one window of one location
+struct sliding_window {
+    int64_t bucket_seconds;
+    std::vector<stream_bucket> ring;
+};
+
+void window_init(sliding_window& window, const stream_window_spec& spec);
+
+//Whether a reading at the UTC instant is too late for the window, older than every
+//bucket that the ring can still hold
+bool window_late(const sliding_window& window, int64_t epoch);
+
+//Add a reading at the UTC instant; returns false (and ignores it) when it is too late
+bool window_add(sliding_window& window, int64_t epoch, float temperature, float humidity);
+
+//Sums of the readings of the window ending at the UTC instant
+stream_average window_query(const sliding_window& window, int64_t epoch);
+
+//Windows of every location of every level, fed one reading at a time. The locations
+//are not known in advance: a room code is interned the first time it is seen, together
+//with the names of its floor, building and neighborhood, so every later reading of the
+//room costs one lookup and 4 * stream_window_count bucket updates.
+struct streaming_averages {
+    //Codes of the rooms and, for each room id, its location id at every level
+    location_dictionary rooms;
+    std::vector<uint32_t> parents[level_count];
+    //Names of the locations of every level and their windows (index id * stream_window_count + w)
+    std::unordered_map<std::string, uint32_t> ids[level_count];
+    std::vector<std::string> names[level_count];
+    std::vector<sliding_window> windows[level_count];
+    //Newest reading seen: the default time of the queries
+    int64_t latest = INT64_MIN;
+    size_t readings = 0;
+    size_t late = 0;
+};
+
+//Add a reading of a room (code N.B.F.R) at the UTC instant to the windows of the room and
+//of its floor, building and neighborhood; a reading too late for any of them is added to
+//none and counted in late
+void streaming_add(streaming_averages& averages, std::string_view code, int64_t epoch, float temperature,
+                   float humidity);
+
+//Sums of the window w of location id of the level, at the UTC instant
+inline stream_average streaming_query(const streaming_averages& averages, int level, uint32_t id, int w,
+                                      int64_t epoch) {
+    return window_query(averages.windows[level][id * stream_window_count + w], epoch);
+}
+
+#endif
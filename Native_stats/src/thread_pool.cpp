@@ -0,0 +1,70 @@
+#include "thread_pool.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct task_queue {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+};
+
+//Next task of the thread: its own first, then one stolen from the others
+static bool next_task(std::vector<task_queue>& queues, size_t self, size_t* task) {
+    {
+        std::lock_guard<std::mutex> guard(queues[self].lock);
+        if (!queues[self].tasks.empty()) {
+            *task = queues[self].tasks.front();
+            queues[self].tasks.pop_front();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+        task_queue& victim = queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            *task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void run_tasks(int threads, size_t count, const std::function<void(size_t)>& run) {
+    size_t n_threads = threads < 1 ? 1 : (size_t) threads;
+    if (n_threads > count) {
+        n_threads = count;
+    }
+    if (n_threads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            run(i);
+        }
+        return;
+    }
+    //Tasks are only taken, never added, so a thread stops when every deque is empty
+    std::vector<task_queue> queues(n_threads);
+    for (size_t i = 0; i < count; i++) {
+        queues[i % n_threads].tasks.push_back(i);
+    }
+    auto work = [&](size_t self) {
+        size_t task;
+        while (next_task(queues, self, &task)) {
+            run(task);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < n_threads; t++) {
+        workers.emplace_back(work, t);
+    }
+    work(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int hardware_threads() {
+    unsigned int threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : (int) threads;
+}
@@ -0,0 +1,18 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstddef>
+#include <functional>
+
+//Run run(0), ..., run(count - 1) on the given number of threads (the calling one
+//included) and return when all of them are done. Every thread has a deque of tasks,
+//dealt in turn in the order of the indexes: it takes its own tasks from the front and,
+//when its deque is empty, steals from the back of the deque of another thread, so the
+//threads that end early help the others. With one thread (or one task) the tasks run
+//in order on the calling thread.
+void run_tasks(int threads, size_t count, const std::function<void(size_t)>& run);
+
+//Threads of the machine (at least 1)
+int hardware_threads();
+
+#endif
@@ -0,0 +1,65 @@
+import ipaddress
+import json
+import struct
+
+#Decoder of the payloads published by the motes on mtds/sensor/data/N/B/F/R. They are
+#either JSON (PAYLOAD_JSON in project-conf.h, one reading or a batch) or the binary record
+#of PAYLOAD_BINARY, little-endian:
+#  u8 version, u8 n, u16 node id, u16 seq of the first reading,
+#  u8[8] interface identifier of the default route,
+#  u16 reading interval in seconds (from version 2),
+#  n times: u16 age in seconds when sent, i16 temperature, u16 humidity (hundredths)
+
+BINARY_VERSION = 2
+HEADERS = {1: struct.Struct("<BBHH8s"), 2: struct.Struct("<BBHH8sH")}
+READING = struct.Struct("<HhH")
+ORG_ID = "mtdssens"
+
+
+def decode(payload, org_id=ORG_ID):
+    #The message as the mote would have sent it in JSON: {"d": {...}}; a binary record
+    #has "age" (seconds before it was sent) instead of t0, tx and dt
+    if payload[:1] == b"{":
+        return json.loads(payload.decode())
+    header = HEADERS.get(payload[0]) if payload else None
+    if header is None or len(payload) < header.size:
+        raise ValueError("Unknown payload " + payload[:16].hex())
+    version, n, node, seq, iid = header.unpack_from(payload)[:5]
+    if len(payload) != header.size + n * READING.size:
+        raise ValueError("Payload of {0} bytes for {1} readings".format(len(payload), n))
+    d = {"s_id": "{0}-{1:04x}".format(org_id, node), "seq": seq, "n": n, "age": [], "temp_c": [], "hum": []}
+    if version >= 2:
+        d["interval"] = header.unpack_from(payload)[5]
+    for i in range(n):
+        age, temperature, humidity = READING.unpack_from(payload, header.size + i * READING.size)
+        d["age"].append(age)
+        d["temp_c"].append(temperature / 100)
+        d["hum"].append(humidity / 100)
+    d["Def Route"] = str(ipaddress.IPv6Address(b"\xfe\x80" + bytes(6) + iid))
+    return {"d": d}
+
+
+def readings(payload, org_id=ORG_ID):
+    #(sensor id, seq, age in seconds, temperature, humidity) of every reading of a payload
+    #of any format; the age of the readings sent one by one is 0
+    d = decode(payload, org_id)["d"]
+    if "n" not in d:
+        return [(d["s_id"], d["seq"], 0, d["temp_c"], d["hum"])]
+    if "age" in d:
+        ages = d["age"]
+    else:
+        ages = []
+        t = d["t0"]
+        for i in range(d["n"]):
+            if i > 0:
+                t += d["dt"][i - 1]
+            ages.append(d["tx"] - t)
+    return [(d["s_id"], d["seq"] + i, ages[i], d["temp_c"][i], d["hum"][i]) for i in range(d["n"])]
+
+
+def encode(s_id_node, seq, values, interval=60, route_iid=bytes(8)):
+    #Binary record of (age, temperature, humidity) readings, as the mote builds it
+    payload = HEADERS[BINARY_VERSION].pack(BINARY_VERSION, len(values), s_id_node, seq, route_iid, interval)
+    for age, temperature, humidity in values:
+        payload += READING.pack(min(age, 0xFFFF), round(temperature * 100), round(humidity * 100))
+    return payload
@@ -1,4 +1,5 @@
 import paho.mqtt.client as mqtt
+import sensor_payload
 
 BROKER = "server.matmacsystem.it"
 PORT = 1883
@@ -11,7 +12,10 @@ def on_connect(client, userdata, flags, rc):
 
 def on_message(client, userdata, msg):
     #print("Message received-> " + msg.topic.replace("mtds/", "").replace("/", ".") + " " + msg.payload.decode())
-    print("Received from topic: " + msg.topic + " - Message: " + msg.payload.decode())
+    if msg.topic.startswith("mtds/sensor/data/"):
+        print("Received from topic: " + msg.topic + " - Message: " + str(sensor_payload.decode(msg.payload)))
+    else:
+        print("Received from topic: " + msg.topic + " - Message: " + msg.payload.decode())
 
 
 client = mqtt.Client("mtds-test-subscriber")